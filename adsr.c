@@ -19,13 +19,36 @@
  */
 
 #include "adsr.h"
-#include "voice.h"
+#include "synth.h"
 #include <stdlib.h>
 
+#ifdef SEQ_STATS
+/*! Count `count` samples of the voice in its current phase */
+static void adsr_stat(SYNTH_CTX_PARAM_ uint32_t count) {
+	uint8_t state = cur_voice->adsr.state_counter;
+	uint8_t phase;
+	if (state == ADSR_STATE_END) {
+		phase = ADSR_PHASE_END;
+	} else if (state < ADSR_STATE_SUSTAIN_START) {
+		phase = ADSR_PHASE_ATTACK;
+	} else if (state < ADSR_STATE_DECAY_START) {
+		phase = ADSR_PHASE_SUSTAIN;
+	} else if (state < cur_voice->adsr.def.release_start) {
+		phase = ADSR_PHASE_DECAY;
+	} else {
+		phase = ADSR_PHASE_RELEASE;
+	}
+	seq_stats.adsr_samples[phase] += count;
+}
+#define ADSR_STAT(count) adsr_stat(SYNTH_CTX_ARG_ count)
+#else
+#define ADSR_STAT(count)
+#endif
+
 /*!
  * Configure the ADSR.
  */
-void adsr_config(struct seq_frame_t* const frame) {
+void adsr_config(SYNTH_CTX_PARAM_ struct seq_frame_t* const frame) {
 	cur_voice->adsr.def.release_start = frame->adsr_release_start;
 	cur_voice->adsr.next_event = cur_voice->adsr.def.time_scale = frame->adsr_time_scale_1;
 	cur_voice->adsr.state_counter = ADSR_STATE_INIT; // 1
@@ -36,16 +59,25 @@ void adsr_config(struct seq_frame_t* const frame) {
 /*!
  * Compute the ADSR gain
  */
-void adsr_next() {
+void adsr_next(SYNTH_CTX_PARAM) {
 	if (cur_voice->adsr.next_event) {
 		/* Still waiting for next event */
+		PROFILE_COST(PROFILE_COST_ADSR_WAIT);
 		cur_voice->adsr.next_event--;
+		ADSR_STAT(1);
 	} else {
 		if (!cur_voice->adsr.state_counter) {
 			// Abort
+			PROFILE_COST(PROFILE_COST_ADSR_END);
 			cur_voice->adsr.gain = 6;
+			ADSR_STAT(1);
 			return;
 		}
+		PROFILE_COST(PROFILE_COST_ADSR_EVENT);
+#ifdef ADSR_GAIN
+		// The gain of every state is precomputed, and `release_start` is the table row
+		cur_voice->adsr.gain = ADSR_GAIN(cur_voice->adsr.def.release_start, cur_voice->adsr.state_counter);
+#else
 		if (cur_voice->adsr.state_counter < ADSR_STATE_SUSTAIN_START) {
 			// Counter from 1 to 6: 5 steps.
 			// From 6 to 0
@@ -64,6 +96,7 @@ void adsr_next() {
 				cur_voice->adsr.gain++;
 			}
 		} 
+#endif
 
 		if (cur_voice->adsr.state_counter > ADSR_TIME_UNITS) {
 			// 0 is the final state (fast to check)
@@ -72,5 +105,37 @@ void adsr_next() {
 			cur_voice->adsr.next_event = cur_voice->adsr.def.time_scale;
 			cur_voice->adsr.state_counter++;
 		}
+		ADSR_STAT(1);
+	}
+}
+
+/*!
+ * Advance the ADSR for a whole run of samples with the same gain
+ */
+TIME_SCALE_T adsr_run(SYNTH_CTX_PARAM_ TIME_SCALE_T count) {
+	TIME_SCALE_T run;
+	if (cur_voice->adsr.next_event) {
+		/* Still waiting for next event */
+		run = cur_voice->adsr.next_event < count ? cur_voice->adsr.next_event : count;
+		cur_voice->adsr.next_event -= run;
+		ADSR_STAT(run);
+		return run;
+	}
+
+	if (!cur_voice->adsr.state_counter) {
+		// Muted from now on
+		adsr_next(SYNTH_CTX_ARG);
+		ADSR_STAT(count - 1);
+		return count;
+	}
+
+	// The event sample, then wait for the next one
+	adsr_next(SYNTH_CTX_ARG);
+	if (cur_voice->adsr.state_counter == ADSR_STATE_END) {
+		return 1;
 	}
+	run = cur_voice->adsr.next_event < count - 1 ? cur_voice->adsr.next_event : count - 1;
+	cur_voice->adsr.next_event -= run;
+	ADSR_STAT(run);
+	return run + 1;
 }
@@ -33,6 +33,16 @@
 #define ADSR_STATE_RELEASE_DURATION (6 * 8)
 #define ADSR_STATE_END				0
 
+/*! Duration of a whole envelope in samples, from `adsr_config` to `ADSR_STATE_END` included */
+#define ADSR_ENV_SAMPLES(time_scale_1) (((uint32_t)(time_scale_1) + 1) * (ADSR_TIME_UNITS + 1))
+
+/*! 
+ * Entries of a row of the gain table, by `state_counter` (see ADSR_GAIN in the port configuration).
+ * With ADSR_GAIN(release_start, state_counter) defined, the state transitions take the gain from the table
+ * instead of the state chain, and the frames carry the table row in `adsr_release_start`.
+ */
+#define ADSR_GAIN_STATES (ADSR_TIME_UNITS + 2)
+
 #include "poly_cfg.h"
 
 /*!
@@ -62,11 +72,18 @@ struct adsr_env_gen_t {
 /*!
  * Configure the ADSR.
  */
-void adsr_config(struct seq_frame_t* const frame);
+void adsr_config(SYNTH_CTX_PARAM_ struct seq_frame_t* const frame);
 
 /*!
  * Compute the ADSR gain as bit shift count (0 is full amplitude, 1 is half, etc...)
  */
-void adsr_next();
+void adsr_next(SYNTH_CTX_PARAM);
+
+/*!
+ * Run-length mode: advance the ADSR by up to `count` (> 0) samples in one step, as long as the
+ * gain doesn't change. Returns the samples consumed, the present `gain` applies to all of them.
+ * Same result of calling `adsr_next` once per sample.
+ */
+TIME_SCALE_T adsr_run(SYNTH_CTX_PARAM_ TIME_SCALE_T count);
 
 #endif
@@ -19,12 +19,13 @@
  */
 
 #include "codegen.h"
+#include "synth.h"
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
 
-static void distribution_codegen(FILE *file, const char* var_name, const char* var_type, struct ref_map_t* refs) {
+static void distribution_codegen(FILE *file, const char* var_name, const char* var_type, const struct ref_map_t* refs) {
     fprintf(file, "const %s %s[] = {\n\t", var_type, var_name);
     for (int i = 0; i < refs->count; i++) {
         fprintf(file, "0x%x, ", refs->values[i]);
@@ -32,11 +33,315 @@ static void distribution_codegen(FILE *file, const char* var_name, const char* v
     fprintf(file, "\n};\n\n");
 }
 
-int codegen_write(const char* tune_name, struct bit_stream_t* stream, int channel_count, int has_clip) {
+static void code_counts_codegen(FILE *file, const char* var_name, const struct ref_map_t* refs) {
+    fprintf(file, "const uint8_t %s[] = {\n\t", var_name);
+    for (int i = 0; i < refs->code_bits; i++) {
+        fprintf(file, "%d, ", refs->code_counts[i]);
+    }
+    // No empty arrays
+    if (!refs->code_bits) {
+        fprintf(file, "0");
+    }
+    fprintf(file, "\n};\n\n");
+}
+
+/*! Names of the frame fields, in frame order */
+static const char* const field_names[4] = { "adsr_time_scale", "wf_period", "wf_amplitude", "adsr_release_start" };
+
+/*! Local ref tables of the tunes of a pack, of shared refs, and the base of each tune in them */
+static void local_refs_codegen(FILE *file, const char* var_name, const int* refs, const int* offsets, int tune_count) {
+    fprintf(file, "const uint8_t %s_locals[] = {\n\t", var_name);
+    for (int i = 0; i < offsets[tune_count]; i++) {
+        fprintf(file, "%d, ", refs[i]);
+    }
+    // No empty arrays
+    if (!offsets[tune_count]) {
+        fprintf(file, "0");
+    }
+    fprintf(file, "\n};\n");
+    fprintf(file, "const uint16_t %s_bases[TUNE_PACK_COUNT] = { ", var_name);
+    for (int t = 0; t < tune_count; t++) {
+        fprintf(file, "%d, ", offsets[t]);
+    }
+    fprintf(file, "};\n\n");
+}
+
+/*! 
+ * Table of the ADSR gain after each state transition, for the used release starts (see ADSR_GAIN).
+ * The gains are the ones of the actual envelope, run on a scratch voice.
+ */
+static void gains_codegen(FILE *file, const struct ref_map_t* refs) {
+#ifdef SYNTH_REENTRANT
+	struct synth_ctx_t engine;
+	struct synth_ctx_t* ctx = &engine;
+	// The stats of the scratch engine are discarded
+	memset(&engine, 0, sizeof(engine));
+#else
+	struct voice_ch_t* saved_voice = cur_voice;
+#endif
+	struct voice_ch_t voice;
+	memset(&voice, 0, sizeof(voice));
+	fprintf(file, "#ifdef ADSR_GAIN\n");
+	fprintf(file, "// Gain after the transition of each ADSR state, by release start ref\n");
+	fprintf(file, "const uint8_t tune_adsr_gains[][%d] = {\n", ADSR_GAIN_STATES);
+	for (int i = 0; i < refs->count; i++) {
+		struct seq_frame_t frame;
+		memset(&frame, 0, sizeof(frame));
+		frame.adsr_release_start = refs->values[i];
+		cur_voice = &voice;
+		adsr_config(SYNTH_CTX_ARG_ &frame);
+
+		uint8_t gains[ADSR_GAIN_STATES];
+		// ADSR_STATE_END is muted before the table lookup
+		gains[ADSR_STATE_END] = 6;
+		while (voice.adsr.state_counter != ADSR_STATE_END) {
+			uint8_t state = voice.adsr.state_counter;
+			// No time scale: every call is a transition
+			adsr_next(SYNTH_CTX_ARG);
+			gains[state] = voice.adsr.gain;
+		}
+		fprintf(file, "\t{ ");
+		for (int state = 0; state < ADSR_GAIN_STATES; state++) {
+			fprintf(file, "%d, ", gains[state]);
+		}
+		fprintf(file, "},\n");
+	}
+	fprintf(file, "};\n");
+	fprintf(file, "#endif\n\n");
+#ifndef SYNTH_REENTRANT
+	cur_voice = saved_voice;
+#endif
+}
+
+/*! The refs written in the stream for the period field, see STREAM_PERIOD_DELTA */
+static const struct ref_map_t* period_field(const struct bit_stream_t* stream) {
+	return (stream->flags & STREAM_PERIOD_DELTA) ? &stream->refs_wf_period_delta : &stream->refs_wf_period;
+}
+
+/*! Frame field, for the decoder generation */
+struct field_codegen_t {
+	const char* name;
+	const char* refs_name;
+	const struct ref_map_t* refs;
+};
+
+static int gcd(int a, int b) {
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*! 
+ * Write a `new_frame_require` for this stream only: the field sizes and positions are constants.
+ * The frame positions repeat every lcm(frame bits, 8) bits, so there is a case for every frame phase in that pattern,
+ * each one with its constant bit offsets. The fields with a single value are constants, and aren't read at all.
+ * The end-of-stream test is the same of the generic PIC decoder.
+ */
+static void decoder_codegen(FILE* file, const struct bit_stream_t* stream) {
+	const struct field_codegen_t fields[] = {
+		{ "adsr_time_scale", "tune_adsr_time_scale_refs", &stream->refs_adsr_time_scale },
+		{ "wf_period", "tune_wf_period_refs", period_field(stream) },
+		{ "wf_amplitude", "tune_wf_amplitude_refs", &stream->refs_wf_amplitude },
+		{ "adsr_release_start", "tune_adsr_release_start_refs", &stream->refs_adsr_release_start }
+	};
+	const int field_count = sizeof(fields) / sizeof(fields[0]);
+
+	int aligned = (stream->flags & STREAM_BYTE_ALIGNED) != 0;
+	int counted = STREAM_COUNTED_END(stream->flags);
+	int frame_stride = aligned ? stream->frame_bytes * 8 : stream->frame_bits;
+	int phases = frame_stride ? 8 / gcd(frame_stride, 8) : 1;
+	int pattern_bytes = phases * frame_stride / 8;
+
+	if ((stream->flags & (STREAM_HUFFMAN | STREAM_PATTERNS)) || stream->tune_count > 1) {
+		// Variable-length frames and packs of tunes, decoded by the generic decoder only
+		return;
+	}
+
+	fprintf(file, "#if defined(TUNE_GEN_DECODER) && !defined(TUNE_EEPROM)\n");
+	fprintf(file, "// Frame decoder: %d bits per frame, %d phases of %d bytes\n\n", stream->frame_bits, phases, pattern_bytes);
+	fprintf(file, "static const uint8_t* tune_ptr;\n");
+	if (phases > 1) {
+		fprintf(file, "static uint8_t tune_phase;\n");
+	}
+	if (counted) {
+		fprintf(file, "static uint16_t tune_frames;\n");
+	}
+	fprintf(file, "\nvoid tune_decoder_reset() {\n");
+	fprintf(file, "\ttune_ptr = tune_data;\n");
+	if (phases > 1) {
+		fprintf(file, "\ttune_phase = 0;\n");
+	}
+	if (counted) {
+		fprintf(file, "\ttune_frames = TUNE_FRAME_COUNT;\n");
+	}
+	fprintf(file, "}\n\n");
+
+	fprintf(file, "void new_frame_require() {\n");
+	for (int f = 0; f < field_count; f++) {
+		if (fields[f].refs->bit_count) {
+			fprintf(file, "\tuint8_t ref_%s;\n", fields[f].name);
+		}
+	}
+	if (counted) {
+		fprintf(file, "\tif (!tune_frames) {\n");
+		fprintf(file, "\t\tseq_buf_frame.adsr_time_scale_1 = 0;\n");
+		fprintf(file, "\t\treturn;\n");
+		fprintf(file, "\t}\n");
+		fprintf(file, "\ttune_frames--;\n");
+	} else {
+		fprintf(file, "\tuint8_t end;\n");
+	}
+
+	const char* indent = "\t";
+	if (phases > 1) {
+		fprintf(file, "\tswitch (tune_phase) {\n");
+		indent = "\t\t";
+	}
+	for (int phase = 0; phase < phases; phase++) {
+		if (phases > 1) {
+			if (phase < phases - 1) {
+				fprintf(file, "\tcase %d:\n", phase);
+			} else {
+				fprintf(file, "\tdefault:\n");
+			}
+		}
+		// Bit offset of the field from `tune_ptr`
+		int offset = phase * frame_stride;
+		for (int f = 0; f < field_count; f++) {
+			int bits = fields[f].refs->bit_count;
+			if (!bits) {
+				continue;
+			}
+			int byte = offset >> 3;
+			int shift = offset & 7;
+			fprintf(file, "%sref_%s = ", indent, fields[f].name);
+			if (shift + bits <= 8) {
+				if (shift) {
+					fprintf(file, "(uint8_t)(tune_ptr[%d] >> %d)", byte, shift);
+				} else {
+					fprintf(file, "tune_ptr[%d]", byte);
+				}
+			} else {
+				fprintf(file, "(uint8_t)((tune_ptr[%d] >> %d) | (tune_ptr[%d] << %d))", byte, shift, byte + 1, 8 - shift);
+			}
+			if (shift + bits != 8) {
+				fprintf(file, " & 0x%x", (1 << bits) - 1);
+			}
+			fprintf(file, ";\n");
+			offset += bits;
+		}
+
+		// Stream position after the frame, tested as the generic decoder does. The counted frames are tested at the function start.
+		if (!counted) {
+			int end_offset;
+			if (aligned) {
+				// tune_ptr + TUNE_FRAME_BYTES > tune_data + TUNE_DATA_SIZE - 1
+				end_offset = stream->data_size - (phase + 1) * stream->frame_bytes;
+			} else {
+				// tune_ptr + bytes read >= tune_data + TUNE_DATA_SIZE - 2
+				end_offset = stream->data_size - 2 - (((phase + 1) * frame_stride) >> 3);
+			}
+			if (end_offset > 0) {
+				fprintf(file, "%send = tune_ptr >= tune_data + %d;\n", indent, end_offset);
+			} else {
+				fprintf(file, "%send = 1;\n", indent);
+			}
+		}
+
+		if (phase < phases - 1) {
+			fprintf(file, "%stune_phase = %d;\n", indent, phase + 1);
+			fprintf(file, "%sbreak;\n", indent);
+		} else {
+			if (pattern_bytes) {
+				fprintf(file, "%stune_ptr += %d;\n", indent, pattern_bytes);
+			}
+			if (phases > 1) {
+				fprintf(file, "%stune_phase = 0;\n", indent);
+				fprintf(file, "%sbreak;\n", indent);
+			}
+		}
+	}
+	if (phases > 1) {
+		fprintf(file, "\t}\n");
+	}
+
+	// Frame values
+	indent = "\t";
+	if (counted) {
+		fprintf(file, "\n");
+	} else {
+		fprintf(file, "\n\tif (end");
+		if (!aligned) {
+			for (int f = 0; f < field_count; f++) {
+				if (fields[f].refs->bit_count) {
+					fprintf(file, " && !ref_%s", fields[f].name);
+				}
+			}
+		}
+		fprintf(file, ") {\n");
+		fprintf(file, "\t\tseq_buf_frame.adsr_time_scale_1 = 0;\n");
+		fprintf(file, "\t} else {\n");
+		indent = "\t\t";
+	}
+	for (int f = 0; f < field_count; f++) {
+		const char* field_name = f == 0 ? "adsr_time_scale_1" : fields[f].name;
+		if (fields[f].refs == &stream->refs_wf_period_delta) {
+			// The period ref is the sum of the intervals on the voice
+			if (fields[f].refs->bit_count) {
+				fprintf(file, "%scur_voice->period_ref += tune_wf_period_deltas[ref_%s];\n", indent, fields[f].name);
+			} else {
+				fprintf(file, "%scur_voice->period_ref += %d;\n", indent, fields[f].refs->values[0]);
+			}
+			fprintf(file, "%sseq_buf_frame.%s = %s[cur_voice->period_ref];\n", indent, field_name, fields[f].refs_name);
+		} else if (fields[f].refs == &stream->refs_adsr_release_start) {
+			// The row of the gain table, or the release start
+			fprintf(file, "#ifdef ADSR_GAIN\n");
+			if (fields[f].refs->bit_count) {
+				fprintf(file, "%sseq_buf_frame.%s = ref_%s;\n", indent, field_name, fields[f].name);
+				fprintf(file, "#else\n");
+				fprintf(file, "%sseq_buf_frame.%s = %s[ref_%s];\n", indent, field_name, fields[f].refs_name, fields[f].name);
+			} else {
+				fprintf(file, "%sseq_buf_frame.%s = 0;\n", indent, field_name);
+				fprintf(file, "#else\n");
+				fprintf(file, "%sseq_buf_frame.%s = %d;\n", indent, field_name, fields[f].refs->values[0]);
+			}
+			fprintf(file, "#endif\n");
+		} else if (fields[f].refs->bit_count) {
+			fprintf(file, "%sseq_buf_frame.%s = %s[ref_%s];\n", indent, field_name, fields[f].refs_name, fields[f].name);
+		} else {
+			fprintf(file, "%sseq_buf_frame.%s = %d;\n", indent, field_name, fields[f].refs->values[0]);
+		}
+	}
+	if (!counted) {
+		fprintf(file, "\t}\n");
+	}
+	fprintf(file, "}\n");
+	fprintf(file, "#endif\n\n");
+}
+
+/*! Open a file in the output folder */
+static FILE* open_out_file(const char* out_dir, const char* file_name, char* path, size_t path_size) {
+	if (out_dir) {
+		snprintf(path, path_size, "%s/%s", out_dir, file_name);
+	} else {
+		snprintf(path, path_size, "%s", file_name);
+	}
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "Cannot write the %s file\n", path);
+	}
+	return file;
+}
+
+int codegen_write(const char* tune_name, const char* out_dir, struct bit_stream_t* stream, int channel_count, int has_clip) {
+	char path[4096];
+
     // Prepare the header for tune_gen.h (with dynamic bit sizes)
-	FILE *hSrc = fopen("tune_gen.h", "w");
+	FILE *hSrc = open_out_file(out_dir, "tune_gen.h", path, sizeof(path));
 	if (!hSrc) {
-		fprintf(stderr, "Cannot write the tune_gen.h file\n");
 		return 1;
 	}
 
@@ -46,11 +351,40 @@ int codegen_write(const char* tune_name, struct bit_stream_t* stream, int channe
 	fprintf(hSrc, "// Tune: %s\n\n", tune_name);
 
 	fprintf(hSrc, "#define BITS_ADSR_TIME_SCALE %d\n", stream->refs_adsr_time_scale.bit_count);
-	fprintf(hSrc, "#define BITS_WF_PERIOD %d\n", stream->refs_wf_period.bit_count);
+	fprintf(hSrc, "#define BITS_WF_PERIOD %d\n", period_field(stream)->bit_count);
 	fprintf(hSrc, "#define BITS_WF_AMPLITUDE %d\n", stream->refs_wf_amplitude.bit_count);
 	fprintf(hSrc, "#define BITS_ADSR_RELEASE_START %d\n\n", stream->refs_adsr_release_start.bit_count);
 
 	fprintf(hSrc, "#define TUNE_DATA_SIZE %d\n", stream->data_size);
+	if (stream->flags & STREAM_BYTE_ALIGNED) {
+		fprintf(hSrc, "#define TUNE_BYTE_ALIGNED\n");
+		fprintf(hSrc, "#define TUNE_FRAME_BYTES %d\n", stream->frame_bytes);
+	}
+	if (stream->flags & STREAM_PERIOD_DELTA) {
+		fprintf(hSrc, "#define TUNE_PERIOD_DELTA\n");
+	}
+	if (STREAM_COUNTED_END(stream->flags)) {
+		fprintf(hSrc, "#define TUNE_FRAME_COUNT %d\n", stream->frame_count);
+	}
+	if (stream->tune_count > 1) {
+		fprintf(hSrc, "#define TUNE_PACK_COUNT %d\n", stream->tune_count);
+		if (stream->local_refs[0]) {
+			fprintf(hSrc, "#define TUNE_PACK_LOCAL_REFS\n");
+		}
+	}
+	if (stream->flags & STREAM_PATTERNS) {
+		fprintf(hSrc, "#define TUNE_PATTERNS\n");
+		fprintf(hSrc, "#define PATTERN_CALL %d\n", stream->refs_adsr_time_scale.count);
+		fprintf(hSrc, "#define PATTERN_PTR_BITS %d\n", stream->pattern_ptr_bits);
+		fprintf(hSrc, "#define PATTERN_LEN_BITS %d\n", stream->pattern_len_bits);
+	}
+	if (stream->flags & STREAM_HUFFMAN) {
+		fprintf(hSrc, "#define TUNE_HUFFMAN\n");
+		fprintf(hSrc, "#define CODE_BITS_ADSR_TIME_SCALE %d\n", stream->refs_adsr_time_scale.code_bits);
+		fprintf(hSrc, "#define CODE_BITS_WF_PERIOD %d\n", period_field(stream)->code_bits);
+		fprintf(hSrc, "#define CODE_BITS_WF_AMPLITUDE %d\n", stream->refs_wf_amplitude.code_bits);
+		fprintf(hSrc, "#define CODE_BITS_ADSR_RELEASE_START %d\n", stream->refs_adsr_release_start.code_bits);
+	}
 	if (!has_clip) {
 		fprintf(hSrc, "#define NO_CLIP_CHECK\n");
 	}
@@ -60,27 +394,104 @@ int codegen_write(const char* tune_name, struct bit_stream_t* stream, int channe
     fprintf(hSrc, "extern const uint16_t tune_wf_period_refs[];\n");
     fprintf(hSrc, "extern const int8_t tune_wf_amplitude_refs[];\n");
     fprintf(hSrc, "extern const uint8_t tune_adsr_release_start_refs[];\n");
-    fprintf(hSrc, "extern const uint8_t tune_data[TUNE_DATA_SIZE];\n\n");
+    fprintf(hSrc, "extern const uint8_t tune_data[TUNE_DATA_SIZE];\n");
+    fprintf(hSrc, "extern const uint8_t tune_adsr_gains[][%d];\n\n", ADSR_GAIN_STATES);
+	if (stream->flags & STREAM_PERIOD_DELTA) {
+		fprintf(hSrc, "// Intervals of the period refs\n");
+		fprintf(hSrc, "extern const uint8_t tune_wf_period_deltas[];\n\n");
+	}
+	if (stream->tune_count > 1) {
+		fprintf(hSrc, "// Directory of the tunes: the offset of each one in tune_data, plus the end\n");
+		fprintf(hSrc, "extern const uint16_t tune_pack_offsets[TUNE_PACK_COUNT + 1];\n");
+		if (STREAM_COUNTED_END(stream->flags)) {
+			fprintf(hSrc, "extern const uint16_t tune_pack_frames[TUNE_PACK_COUNT];\n");
+		}
+		if (stream->local_refs[0]) {
+			fprintf(hSrc, "// Local ref tables of the tunes, indexed by the frame refs from the base of the tune, of refs to the tables above\n");
+			for (int f = 0; f < 4; f++) {
+				fprintf(hSrc, "extern const uint8_t tune_pack_%s_locals[];\n", field_names[f]);
+				fprintf(hSrc, "extern const uint16_t tune_pack_%s_bases[TUNE_PACK_COUNT];\n", field_names[f]);
+			}
+		}
+		fprintf(hSrc, "\n");
+	}
+	if ((stream->flags & (STREAM_HUFFMAN | STREAM_PATTERNS)) || stream->tune_count > 1) {
+		if (stream->flags & STREAM_HUFFMAN) {
+			fprintf(hSrc, "// Count of the Huffman codes of each length\n");
+			fprintf(hSrc, "extern const uint8_t tune_adsr_time_scale_codes[];\n");
+			fprintf(hSrc, "extern const uint8_t tune_wf_period_codes[];\n");
+			fprintf(hSrc, "extern const uint8_t tune_wf_amplitude_codes[];\n");
+			fprintf(hSrc, "extern const uint8_t tune_adsr_release_start_codes[];\n\n");
+		}
+	} else {
+		fprintf(hSrc, "#if defined(TUNE_GEN_DECODER) && !defined(TUNE_EEPROM)\n");
+		fprintf(hSrc, "// Rewind the generated decoder\n");
+		fprintf(hSrc, "void tune_decoder_reset(void);\n");
+		fprintf(hSrc, "#endif\n\n");
+	}
 
-	printf("File tune_gen.h written\n");
+	if (seq_verbose) {
+		printf("File %s written\n", path);
+	}
 	fclose(hSrc);
 
 	// Save the compiled output to tune_gen.c (table sources)
-	FILE *cSrc = fopen("tune_gen.c", "w");
+	FILE *cSrc = open_out_file(out_dir, "tune_gen.c", path, sizeof(path));
 	if (!cSrc) {
-		fprintf(stderr, "Cannot write the tune_gen.c file\n");
 		return 1;
 	}
-	fprintf(cSrc, "#include \"tune_gen.h\"\n\n");
+	fprintf(cSrc, "#include \"tune_gen.h\"\n");
+	if (stream->flags & STREAM_PERIOD_DELTA) {
+		// For the voices of the generated decoder
+		fprintf(cSrc, "#include \"synth.h\"\n");
+	}
+	fprintf(cSrc, "\n");
 
-	fprintf(hSrc, "// Auto-generated code. Don't modify\n");
+	fprintf(cSrc, "// Auto-generated code. Don't modify\n");
 	fprintf(cSrc, "// Tune: %s\n\n", tune_name);
 
     distribution_codegen(cSrc, "tune_adsr_time_scale_refs", "uint16_t", &stream->refs_adsr_time_scale);
     distribution_codegen(cSrc, "tune_wf_period_refs", "uint16_t", &stream->refs_wf_period);
     distribution_codegen(cSrc, "tune_wf_amplitude_refs", "int8_t", &stream->refs_wf_amplitude);
     distribution_codegen(cSrc, "tune_adsr_release_start_refs", "uint8_t", &stream->refs_adsr_release_start);
+	if (stream->flags & STREAM_PERIOD_DELTA) {
+		distribution_codegen(cSrc, "tune_wf_period_deltas", "uint8_t", &stream->refs_wf_period_delta);
+	}
+
+	if (stream->flags & STREAM_HUFFMAN) {
+		code_counts_codegen(cSrc, "tune_adsr_time_scale_codes", &stream->refs_adsr_time_scale);
+		code_counts_codegen(cSrc, "tune_wf_period_codes", period_field(stream));
+		code_counts_codegen(cSrc, "tune_wf_amplitude_codes", &stream->refs_wf_amplitude);
+		code_counts_codegen(cSrc, "tune_adsr_release_start_codes", &stream->refs_adsr_release_start);
+	}
 
+	gains_codegen(cSrc, &stream->refs_adsr_release_start);
+
+	if (stream->tune_count > 1) {
+		fprintf(cSrc, "const uint16_t tune_pack_offsets[TUNE_PACK_COUNT + 1] = { ");
+		for (int i = 0; i <= stream->tune_count; i++) {
+			fprintf(cSrc, "%d, ", stream->tune_offsets[i]);
+		}
+		fprintf(cSrc, "};\n");
+		if (STREAM_COUNTED_END(stream->flags)) {
+			fprintf(cSrc, "const uint16_t tune_pack_frames[TUNE_PACK_COUNT] = { ");
+			for (int i = 0; i < stream->tune_count; i++) {
+				fprintf(cSrc, "%d, ", stream->tune_frame_counts[i]);
+			}
+			fprintf(cSrc, "};\n");
+		}
+		fprintf(cSrc, "\n");
+		if (stream->local_refs[0]) {
+			for (int f = 0; f < 4; f++) {
+				char name[64];
+				snprintf(name, sizeof(name), "tune_pack_%s", field_names[f]);
+				local_refs_codegen(cSrc, name, stream->local_refs[f], stream->local_offsets[f], stream->tune_count);
+			}
+		}
+	}
+
+	fprintf(cSrc, "// In the serial EEPROM with TUNE_EEPROM, see tune_gen.bin\n");
+	fprintf(cSrc, "#ifndef TUNE_EEPROM\n");
     fprintf(cSrc, "const uint8_t tune_data[TUNE_DATA_SIZE] = {\n\t");
 	for (int i = 0; i < stream->data_size; i++) {
 		fprintf(cSrc, "0x%x, ", stream->data[i]);
@@ -89,9 +500,29 @@ int codegen_write(const char* tune_name, struct bit_stream_t* stream, int channe
 		}
 	}
 
-	fprintf(cSrc, "\n};\n\n");
-	printf("File tune_gen.c written\n");
+	fprintf(cSrc, "\n};\n");
+	fprintf(cSrc, "#endif\n\n");
+
+	decoder_codegen(cSrc, stream);
+	if (seq_verbose) {
+		printf("File %s written\n", path);
+	}
 	fclose(cSrc);
 
+	// Raw image of the stream, to flash the serial EEPROM
+	FILE *bin = open_out_file(out_dir, "tune_gen.bin", path, sizeof(path));
+	if (!bin) {
+		return 1;
+	}
+	int err = fwrite(stream->data, 1, stream->data_size, bin) != (size_t)stream->data_size;
+	err |= fclose(bin) != 0;
+	if (err) {
+		fprintf(stderr, "Cannot write the %s file\n", path);
+		return 1;
+	}
+	if (seq_verbose) {
+		printf("File %s written\n", path);
+	}
+
 	return 0;
 }
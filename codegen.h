@@ -22,7 +22,7 @@
 
 #include "sequencer.h"
 
-/*! Write the source code with the stream data */
-int codegen_write(const char* tune_name, struct bit_stream_t* stream, int channel_count, int do_clip_check);
+/*! Write the source code with the stream data, as `tune_gen.h`/`tune_gen.c` in the `out_dir` folder (the current one if NULL) */
+int codegen_write(const char* tune_name, const char* out_dir, struct bit_stream_t* stream, int channel_count, int do_clip_check);
 
 #endif
\ No newline at end of file
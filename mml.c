@@ -29,61 +29,92 @@
 /*!
  * Not optimized for microcontroller usage.
  * Requires dynamic memory allocation support (heap), especially `malloc` and `realloc`.
+ * The file is parsed one line at a time, so it can be fed in chunks of any size (see `mml_feed`).
  */
 
 /*! Manage parser errors */
 static void (*error_handler)(const char* err, int line, int column);
-static int line = 1;
-static int pos = 1;
 
 #define ARTICULATION_STACCATO (2.5 / 4.0)
 #define ARTICULATION_NORMAL (7.0 / 8.0)
 #define ARTICULATION_LEGATO (1.0)
 
-/*! Temporary list of sequencer stream frames, per channel */
-static struct seq_frame_map_t frame_map;
+struct mml_channel_state_t;
+
+/*! Note codes reachable by the parser: 0 is "C" at octave 0, up to "B" at octave 9 */
+#define NOTE_CODE_COUNT (10 * 12)
+
+/*! Parser state. Every `mml_open` call allocates its own one, so more files can be parsed at the same time */
+struct mml_parser_t {
+	/*! Position of the parser, for error reporting */
+	int line;
+	int pos;
+	/*! Temporary list of sequencer stream frames, per channel */
+	struct seq_frame_map_t frame_map;
+	/*! Allocated frames of every channel of `frame_map` */
+	int* frame_capacity;
+	/*! State of every channel */
+	struct mml_channel_state_t* channel_states;
+	int channel_count;
+	/*! Incomplete line of the last `mml_feed` chunk */
+	char* line_buf;
+	size_t line_size;
+	size_t line_capacity;
+	/*! Set by the first parse error, that ends the parsing */
+	int error;
+	/*! Channels ignored by the parser, see `mml_skip_channels` */
+	uint32_t skip_channels;
+	/*! Waveform period of every note code, see `init_note_periods` */
+	uint16_t note_periods[NOTE_CODE_COUNT];
+};
+
+/*! Initial frames of a channel, doubled every time the list is full */
+#define CHANNEL_MIN_FRAMES 16
 
-static void init_stream_channel(int channel) {
+static void init_stream_channel(struct mml_parser_t* parser, int channel) {
 	// Init new channels
-	frame_map.channels[channel].count = 0;
-	frame_map.channels[channel].frames = malloc(sizeof(struct seq_frame_t) * 16);
+	parser->frame_map.channels[channel].count = 0;
+	parser->frame_map.channels[channel].frames = malloc(sizeof(struct seq_frame_t) * CHANNEL_MIN_FRAMES);
+	parser->frame_capacity[channel] = CHANNEL_MIN_FRAMES;
 }
 
-static int add_channel_frame(int channel, int frequency, int time_scale, int volume, double articulation, int edit_last_duration) {
+static int add_channel_frame(struct mml_parser_t* parser, int channel, int note_code, int time_scale, int volume, double articulation, int edit_last_duration) {
 	// New channel?
-	if (channel >= frame_map.channel_count) {
-		int old_count = frame_map.channel_count;
-		frame_map.channel_count = channel + 1;
-		frame_map.channels = realloc(frame_map.channels, sizeof(struct seq_frame_list_t) * frame_map.channel_count);
-		for (int i = old_count; i < frame_map.channel_count; i++) {
+	if (channel >= parser->frame_map.channel_count) {
+		int old_count = parser->frame_map.channel_count;
+		parser->frame_map.channel_count = channel + 1;
+		parser->frame_map.channels = realloc(parser->frame_map.channels, sizeof(struct seq_frame_list_t) * parser->frame_map.channel_count);
+		parser->frame_capacity = realloc(parser->frame_capacity, sizeof(int) * parser->frame_map.channel_count);
+		for (int i = old_count; i < parser->frame_map.channel_count; i++) {
 			// Init new channels
-			init_stream_channel(i);
+			init_stream_channel(parser, i);
 		}
 	}
 
-	struct seq_frame_list_t* list = &frame_map.channels[channel];
-	if (!edit_last_duration && list->count > 0 && (list->count % 16) == 0) {
-		list->frames = realloc(list->frames, sizeof(struct seq_frame_t) * (list->count + 16));
+	struct seq_frame_list_t* list = &parser->frame_map.channels[channel];
+	if (!edit_last_duration && list->count == parser->frame_capacity[channel]) {
+		// Geometric growth, so the frames are copied O(1) times on average
+		parser->frame_capacity[channel] *= 2;
+		list->frames = realloc(list->frames, sizeof(struct seq_frame_t) * parser->frame_capacity[channel]);
 	}
 
 	if (edit_last_duration && list->count == 0) {
-		error_handler("Can't join, no note before", line, pos);
+		error_handler("Can't join, no note before", parser->line, parser->pos);
 		return 0;
 	}
 
 	int i = edit_last_duration ? (list->count - 1) : (list->count++);
 	struct seq_frame_t* frame = &list->frames[i];
 
-    if (!frequency) {
+    if (note_code < 0) {
 		if (!voice_wf_setup_def(frame, 0, 0)) {
-			error_handler("Can't pack frame: pause", line, pos);
+			error_handler("Can't pack frame: pause", parser->line, parser->pos);
 			return 0;
 		}
     } else {
-		if (!voice_wf_setup_def(frame, frequency, volume)) {
-			error_handler("Can't pack frame: waveform", line, pos);
-			return 0;
-		}
+		// Same of `voice_wf_setup_def`, with the period from the table
+		frame->wf_amplitude = volume;
+		frame->wf_period = parser->note_periods[note_code];
     }
 
 	// Calc duration and scale
@@ -91,7 +122,7 @@ static int add_channel_frame(int channel, int frequency, int time_scale, int vol
 		time_scale += (frame->adsr_time_scale_1 + 1);
 	}
 	if (time_scale > UINT16_MAX) {
-		error_handler("Can't pack frame: adsr time_scale", line, pos);
+		error_handler("Can't pack frame: adsr time_scale", parser->line, parser->pos);
 		return 0;
 	}
 	frame->adsr_time_scale_1 = time_scale - 1;
@@ -132,8 +163,8 @@ static int get_freq_from_code(int noteCode) {
 	return (int)(440.0 * pow(2, ((noteCode - 33) / 12.0)));
 }
 
-/*! Convert a a-g code chromatic scale to frequency. Octave 2 is the fourth-octave in scientific pitch */
-static int get_freq_from_note(char note, int sharp, int octave) {
+/*! Convert a a-g code chromatic scale to note code. Octave 2 is the fourth-octave in scientific pitch */
+static int get_code_from_note(char note, int sharp, int octave) {
 	int semitone = ((note - 'a' + 5) % 7) * 2;
 	if (semitone > 4) {
 		semitone--;
@@ -142,9 +173,24 @@ static int get_freq_from_note(char note, int sharp, int octave) {
 		semitone++;
 	}
 	// semitone is 0 for c
-	return get_freq_from_code(semitone + octave * 12);
+	return semitone + octave * 12;
+}
+
+/*! 
+ * Compute the waveform period of every note code once per parser, instead of the `pow()` and 
+ * the period division of every note. `synth_freq` can be a variable, so the table can't be constant.
+ */
+static void init_note_periods(struct mml_parser_t* parser) {
+	for (int i = 0; i < NOTE_CODE_COUNT; i++) {
+		struct seq_frame_t frame;
+		voice_wf_setup_def(&frame, get_freq_from_code(i), 0);
+		parser->note_periods[i] = frame.wf_period;
+	}
 }
 
+/*! Entries of the note duration cache of the channels, must be a power of 2 */
+#define LENGTH_CACHE_SIZE 8
+
 /*! Parser state, per channel */
 struct mml_channel_state_t {
 	int octave;
@@ -153,6 +199,12 @@ struct mml_channel_state_t {
 	int tempo;
 	int volume;
 	double articulation;
+	/*! Duration in seconds of the recent lengths at the current tempo, see `get_adsr_time_scale` */
+	struct {
+		int length;
+		int dots;
+		double seconds;
+	} length_cache[LENGTH_CACHE_SIZE];
 	// Active in current MML parsing line
 	int isActive;
 	// Running time in seconds and time units. Used to round note duration and not accumulate errors (skew between channels).
@@ -161,8 +213,6 @@ struct mml_channel_state_t {
 		int time_units;
 	} running_time;
 };
-static struct mml_channel_state_t* mml_channel_states;
-static int mml_channel_count;
 
 /*! 
  * Get duration in ADSR time scale units. 
@@ -170,11 +220,18 @@ static int mml_channel_count;
  * Length is fraction of whole note. Dots are number of dots (1 dot = 3/2, 2 dots = 9/4, etc..) 
  */
 static int get_adsr_time_scale(struct mml_channel_state_t* state, int length, int dots) {
-	double l = length;
-	for (; dots > 0; dots--) {
-		l /= 1.5;
+	// Tunes use few lengths, so the durations are cached by length in a direct-mapped table
+	int idx = (length * 3 + dots) & (LENGTH_CACHE_SIZE - 1);
+	if (state->length_cache[idx].length != length || state->length_cache[idx].dots != dots) {
+		double l = length;
+		for (int i = dots; i > 0; i--) {
+			l /= 1.5;
+		}
+		state->length_cache[idx].length = length;
+		state->length_cache[idx].dots = dots;
+		state->length_cache[idx].seconds = 60.0 * 4 / state->tempo / l;
 	}
-	double seconds = 60.0 * 4 / state->tempo / l;
+	double seconds = state->length_cache[idx].seconds;
 	state->running_time.seconds += seconds;
 
 	// Round note duration to not accumulate errors (skew between channels)
@@ -186,48 +243,75 @@ static int get_adsr_time_scale(struct mml_channel_state_t* state, int length, in
 	return time_scale;
 }
 
-static void enable_channel(int channel) {
-	if (channel >= mml_channel_count) {
-		mml_channel_count = channel + 1;
-		mml_channel_states = realloc(mml_channel_states, sizeof(struct mml_channel_state_t) * mml_channel_count);
-		// Init new channel
-		mml_channel_states[channel].octave = 4;
-		mml_channel_states[channel].default_length = 4;
-		mml_channel_states[channel].default_length_dot = 0;
-		mml_channel_states[channel].tempo = 120;
-		mml_channel_states[channel].volume = 63;
-		mml_channel_states[channel].articulation = ARTICULATION_NORMAL;
-		mml_channel_states[channel].running_time.seconds = 0;
-		mml_channel_states[channel].running_time.time_units = 0;
+/*! Invalidate the cached durations, e.g. when the tempo changes */
+static void clear_length_cache(struct mml_channel_state_t* state) {
+	for (int i = 0; i < LENGTH_CACHE_SIZE; i++) {
+		// No valid length is 0
+		state->length_cache[i].length = 0;
+	}
+}
+
+static void enable_channel(struct mml_parser_t* parser, int channel) {
+	if (channel >= parser->channel_count) {
+		int old_count = parser->channel_count;
+		parser->channel_count = channel + 1;
+		parser->channel_states = realloc(parser->channel_states, sizeof(struct mml_channel_state_t) * parser->channel_count);
+		// Init new channels, even the skipped ones
+		for (int i = old_count; i < parser->channel_count; i++) {
+			parser->channel_states[i].octave = 4;
+			parser->channel_states[i].default_length = 4;
+			parser->channel_states[i].default_length_dot = 0;
+			parser->channel_states[i].tempo = 120;
+			parser->channel_states[i].volume = 63;
+			parser->channel_states[i].articulation = ARTICULATION_NORMAL;
+			clear_length_cache(&parser->channel_states[i]);
+			parser->channel_states[i].isActive = 0;
+			parser->channel_states[i].running_time.seconds = 0;
+			parser->channel_states[i].running_time.time_units = 0;
+		}
 	}
 
-	mml_channel_states[channel].isActive = 1;
+	parser->channel_states[channel].isActive = 1;
 }
 
 // By default, if no channel identifier at the beginning of a MML line, it is referring to A channel only
-static void reset_active_state() {
-	for (int i = 1; i < mml_channel_count; i++) {
-		mml_channel_states[i].isActive = 0;
+static void reset_active_state(struct mml_parser_t* parser) {
+	for (int i = 1; i < parser->channel_count; i++) {
+		parser->channel_states[i].isActive = 0;
+	}
+	enable_channel(parser, 0);
+	if (parser->skip_channels & 1) {
+		parser->channel_states[0].isActive = 0;
+	}
+}
+
+/*! Deactivate the skipped channels of the line. Returns zero if no channel is left */
+static int apply_skip_channels(struct mml_parser_t* parser) {
+	int active = 0;
+	for (int i = 0; i < parser->channel_count; i++) {
+		if (parser->skip_channels & (1u << i)) {
+			parser->channel_states[i].isActive = 0;
+		}
+		active |= parser->channel_states[i].isActive;
 	}
-	enable_channel(0);
+	return active;
 }
 
 /*! 
- * Parse the MML file and produce sequencer stream of frames in `stream_channel` array.
+ * Parse a line of the MML file (without the line terminator) and add the frames to the channel lists.
  */
-static int mml_parse(const char* content) {
-	line = 1;
-	pos = 0;
-
-	// Starts with 1 voice
-	mml_channel_states = malloc(0);
-	frame_map.channels = malloc(0);
-	frame_map.channel_count = 0;
+static int mml_parse_line(struct mml_parser_t* parser, const char* content) {
+	// By default the line refers to the A channel only
+	reset_active_state(parser);
+	parser->pos = 0;
+	if ((parser->skip_channels & 1) && !(content[0] >= 'A' && content[0] <= 'Z')) {
+		// Line of a skipped A channel
+		return 0;
+	}
 
-	// Read the string until end
-	reset_active_state();
+	// Read the line until end
 	while(1) {
-		pos++;
+		parser->pos++;
 		char code = content[0];
 		content++;
 		if (!code) {
@@ -236,27 +320,15 @@ static int mml_parse(const char* content) {
 
 		if (code <= 32 || code == '|') {
 			// Skip blanks and partitures
-			if (code == '\n') {
-				line++;
-				reset_active_state();
-				pos = 0;
-			}
 			if (code == '\r') {
-				pos--;
+				parser->pos--;
 			}
 			continue;
 		}
 
 		if (code == '#' || code == ';') {
 			// Skip line comment
-			while (*content != '\n') {
-				content++;
-			}
-			content++;
-			line++;
-			reset_active_state();
-			pos = 0;
-			continue;
+			break;
 		}
 
 		// Join last note?
@@ -267,92 +339,96 @@ static int mml_parse(const char* content) {
 		}
 
 		if (code >= 'A' && code <= 'Z') {
-			if (pos == 1) {
+			if (parser->pos == 1) {
 				// Decode active channels
-				mml_channel_states[0].isActive = 0;
-				enable_channel(code - 'A');
+				parser->channel_states[0].isActive = 0;
+				enable_channel(parser, code - 'A');
 				while (*content >= 'A' && *content <= 'Z') {
-					enable_channel(*content - 'A');
+					enable_channel(parser, *content - 'A');
 					content++;
-					pos++;
+					parser->pos++;
+				}
+				if (!apply_skip_channels(parser)) {
+					return 0;
 				}
 				continue;
 			} else {
-				error_handler("Misplaced channel selector", line, pos);
+				error_handler("Misplaced channel selector", parser->line, parser->pos);
 			}
 		}
 
 		int isPause;
-		int isNoteCode;
+		int isNoteCode = 0;
 		if (code == 'o') {
-			int octave = read_digit(&content, &pos);
+			int octave = read_digit(&content, &parser->pos);
 			if (octave == 255 || octave > 6) {
-				error_handler("Invalid octave", line, pos);
+				error_handler("Invalid octave", parser->line, parser->pos);
 				return 1;
 			}
-			for (int i = 0; i < mml_channel_count; i++) {
-				if (mml_channel_states[i].isActive) {
-					mml_channel_states[i].octave = octave;
+			for (int i = 0; i < parser->channel_count; i++) {
+				if (parser->channel_states[i].isActive) {
+					parser->channel_states[i].octave = octave;
 				}
 			}
 		} else if (code == 'l') {
-			int length = read_number(&content, &pos);
+			int length = read_number(&content, &parser->pos);
 			if (length < 0) {
-				error_handler("Invalid length", line, pos);
+				error_handler("Invalid length", parser->line, parser->pos);
 				return 1;
 			}
 			int dot = 0;
 			while (*content == '.') {
 				dot++;
 				content++;
-				pos++;
+				parser->pos++;
 			}
-			for (int i = 0; i < mml_channel_count; i++) {
-				if (mml_channel_states[i].isActive) {
-					mml_channel_states[i].default_length = length;
-					mml_channel_states[i].default_length_dot = dot;
+			for (int i = 0; i < parser->channel_count; i++) {
+				if (parser->channel_states[i].isActive) {
+					parser->channel_states[i].default_length = length;
+					parser->channel_states[i].default_length_dot = dot;
 				}
 			}
 		} else if (code == 't') {
-			int tempo = read_number(&content, &pos);
+			int tempo = read_number(&content, &parser->pos);
 			if (tempo < 0) {
-				error_handler("Invalid tempo", line, pos);
+				error_handler("Invalid tempo", parser->line, parser->pos);
 				return 1;
 			}
-			for (int i = 0; i < mml_channel_count; i++) {
-				if (mml_channel_states[i].isActive) {
-					mml_channel_states[i].tempo = tempo;
+			for (int i = 0; i < parser->channel_count; i++) {
+				if (parser->channel_states[i].isActive) {
+					parser->channel_states[i].tempo = tempo;
+					clear_length_cache(&parser->channel_states[i]);
 				}
 			}
 		} else if (code == 'v') {
-			int volume = read_number(&content, &pos);
+			int volume = read_number(&content, &parser->pos);
 			if (volume < 0 || volume > 128) {
-				error_handler("Invalid volume", line, pos);
+				error_handler("Invalid volume", parser->line, parser->pos);
 				return 1;
 			}
-			for (int i = 0; i < mml_channel_count; i++) {
-				if (mml_channel_states[i].isActive) {
-					mml_channel_states[i].volume = volume;
+			for (int i = 0; i < parser->channel_count; i++) {
+				if (parser->channel_states[i].isActive) {
+					parser->channel_states[i].volume = volume;
 				}
 			}
 		} else if (code == '<') {
-			for (int i = 0; i < mml_channel_count; i++) {
-				if (mml_channel_states[i].isActive) {
-					if (mml_channel_states[i].octave == 0) {
-						error_handler("Invalid octave step down", line, pos);
+			for (int i = 0; i < parser->channel_count; i++) {
+				if (parser->channel_states[i].isActive) {
+					if (parser->channel_states[i].octave == 0) {
+						error_handler("Invalid octave step down", parser->line, parser->pos);
 						return 1;
 					}
-					mml_channel_states[i].octave--;
+					parser->channel_states[i].octave--;
 				}
 			}
 		} else if (code == '>') {
-			for (int i = 0; i < mml_channel_count; i++) {
-				if (mml_channel_states[i].isActive) {
-					if (mml_channel_states[i].octave == 9) {
-						error_handler("Invalid octave step up", line, pos);
+			for (int i = 0; i < parser->channel_count; i++) {
+				if (parser->channel_states[i].isActive) {
+					if (parser->channel_states[i].octave == 9) {
+						error_handler("Invalid octave step up", parser->line, parser->pos);
 						return 1;
 					}
-					mml_channel_states[i].octave++;
+					parser->channel_states[i].octave++;
 				}
 			}
 		} else if (code == 'm') {
@@ -369,15 +445,15 @@ static int mml_parse(const char* content) {
 					articulation = ARTICULATION_STACCATO;
 					break;
 				default:
-					error_handler("Invalid music articulation", line, pos);
+					error_handler("Invalid music articulation", parser->line, parser->pos);
 					return 1;
 			}
-			for (int i = 0; i < mml_channel_count; i++) {
-				if (mml_channel_states[i].isActive) {
-					mml_channel_states[i].articulation = articulation;
+			for (int i = 0; i < parser->channel_count; i++) {
+				if (parser->channel_states[i].isActive) {
+					parser->channel_states[i].articulation = articulation;
 				}
 			}
-			pos++;
+			parser->pos++;
 			content++;
 		} else if ((isPause = (code == 'p' || code == 'r')) || (isNoteCode = code == 'n') || (code >= 'a' && code <= 'g')) {
 			// Note or pause
@@ -397,35 +473,35 @@ static int mml_parse(const char* content) {
 							code--;
 						}
 						if (code == 'e' || code == 'b') {
-							error_handler("Invalid sharp", line, pos);
+							error_handler("Invalid sharp", parser->line, parser->pos);
 							return 1;
 						}
 						sharp = 1;
 						content++;
-						pos++;
+						parser->pos++;
 						continue;
 					}
 				}
 				if (next >= '0' && next <= '9') {
 					if (isNoteCode) {
 						if (noteCode != -1) {
-							error_handler("Invalid note code", line, pos);
+							error_handler("Invalid note code", parser->line, parser->pos);
 							return 1;
 						}
-						noteCode = read_number(&content, &pos);
+						noteCode = read_number(&content, &parser->pos);
 						if (noteCode < 0 || noteCode > 84) {
-							error_handler("Invalid note code", line, pos);
+							error_handler("Invalid note code", parser->line, parser->pos);
 							return 1;
 						}
 					} else {
 						if (customLength) {
-							error_handler("Invalid length", line, pos);
+							error_handler("Invalid length", parser->line, parser->pos);
 							return 1;
 						}
 						// Length
-						length = read_number(&content, &pos);
+						length = read_number(&content, &parser->pos);
 						if (length < 0) {
-							error_handler("Invalid length", line, pos);
+							error_handler("Invalid length", parser->line, parser->pos);
 							return 1;
 						}
 						customLength = 1;
@@ -436,50 +512,144 @@ static int mml_parse(const char* content) {
 					// Half length
 					dot++;
 					content++;
-					pos++;
+					parser->pos++;
 					continue;
 				}
 				break;
 			}
 
 			// Set note
-			for (int i = 0; i < mml_channel_count; i++) {
-				if (mml_channel_states[i].isActive) {
+			for (int i = 0; i < parser->channel_count; i++) {
+				if (parser->channel_states[i].isActive) {
 					if (isNoteCode && noteCode == 0) {
 						isPause = 1;
 					}
-					int frequency = isPause ? 0 : (isNoteCode ? get_freq_from_code(noteCode) : get_freq_from_note(code, sharp, mml_channel_states[i].octave));
-					int time_scale = get_adsr_time_scale(&mml_channel_states[i], length < 0 ? mml_channel_states[i].default_length : length, (length < 0 && !dot) ? mml_channel_states[i].default_length_dot : dot);
+					int note = isPause ? -1 : (isNoteCode ? noteCode : get_code_from_note(code, sharp, parser->channel_states[i].octave));
+					int time_scale = get_adsr_time_scale(&parser->channel_states[i], length < 0 ? parser->channel_states[i].default_length : length, (length < 0 && !dot) ? parser->channel_states[i].default_length_dot : dot);
 					
-					if (!add_channel_frame(i, frequency, time_scale, mml_channel_states[i].volume, mml_channel_states[i].articulation, join)) {
+					if (!add_channel_frame(parser, i, note, time_scale, parser->channel_states[i].volume, parser->channel_states[i].articulation, join)) {
 						return 1;
 					}
 				}
 			}
 		} else {
-			error_handler("Unknown command", line, pos);
+			error_handler("Unknown command", parser->line, parser->pos);
 			return 1;
 		}
 	}
+	return 0;
+}
+
+struct mml_parser_t* mml_open() {
+	struct mml_parser_t* parser = malloc(sizeof(struct mml_parser_t));
+	if (!parser) {
+		return NULL;
+	}
+	parser->line = 1;
+	parser->pos = 0;
+
+	// Starts with 1 voice
+	parser->channel_states = malloc(0);
+	parser->channel_count = 0;
+	parser->frame_map.channels = malloc(0);
+	parser->frame_map.channel_count = 0;
+	parser->frame_capacity = malloc(0);
+
+	parser->line_buf = malloc(256);
+	parser->line_size = 0;
+	parser->line_capacity = 256;
+	parser->error = 0;
+	parser->skip_channels = 0;
+	init_note_periods(parser);
+	return parser;
+}
+
+/*! Parse the buffered line, and restart the buffer */
+static int parse_buffered_line(struct mml_parser_t* parser) {
+	parser->line_buf[parser->line_size] = 0;
+	parser->line_size = 0;
+	return mml_parse_line(parser, parser->line_buf);
+}
+
+int mml_feed(struct mml_parser_t* parser, const char* chunk, size_t size) {
+	while (size && !parser->error) {
+		const char* end = memchr(chunk, '\n', size);
+		size_t len = end ? (size_t)(end - chunk) : size;
+
+		// Keep the line and the terminator of `parse_buffered_line`
+		if (parser->line_size + len + 1 > parser->line_capacity) {
+			while (parser->line_size + len + 1 > parser->line_capacity) {
+				parser->line_capacity *= 2;
+			}
+			parser->line_buf = realloc(parser->line_buf, parser->line_capacity);
+		}
+		memcpy(parser->line_buf + parser->line_size, chunk, len);
+		parser->line_size += len;
+		if (!end) {
+			break;
+		}
+
+		parser->error = parse_buffered_line(parser);
+		parser->line++;
+		chunk += len + 1;
+		size -= len + 1;
+	}
+	return parser->error;
+}
+
+int mml_close(struct mml_parser_t* parser, struct seq_frame_map_t* map) {
+	// Last line, without terminator
+	if (!parser->error) {
+		parser->error = parse_buffered_line(parser);
+	}
+	int err = parser->error;
+
+	if (!err && seq_verbose) {
+		printf("MML stats:\n");
+		for (int i = 0; i < parser->channel_count; i++) {
+			if (parser->skip_channels & (1u << i)) {
+				printf("\tchannel %d skipped\n", i);
+				continue;
+			}
+			printf("\tchannel %d time %fs (%d samples)\n", i, (float)parser->channel_states[i].running_time.seconds, parser->channel_states[i].running_time.time_units);
+		}
+	}
 
-	printf("MML stats:\n");
-	for (int i = 0; i < mml_channel_count; i++) {
-		printf("\tchannel %d time %fs (%d samples)\n", i, (float)mml_channel_states[i].running_time.seconds, mml_channel_states[i].running_time.time_units);
+	if (err) {
+		mml_free(&parser->frame_map);
+	} else {
+		*map = parser->frame_map;
 	}
+	free(parser->frame_capacity);
+	free(parser->channel_states);
+	free(parser->line_buf);
+	free(parser);
+	return err;
+}
 
-	free(mml_channel_states);
+void mml_skip_channels(struct mml_parser_t* parser, uint32_t channels) {
+	parser->skip_channels = channels;
+}
+
+uint32_t mml_line_channels(const char* line, size_t size) {
+	uint32_t channels = 0;
+	// Same channel selector of `mml_parse_line`
+	for (size_t i = 0; i < size && line[i] >= 'A' && line[i] <= 'Z'; i++) {
+		channels |= 1u << (line[i] - 'A');
+	}
+	return channels ? channels : 1;
 }
 
 /*! 
  * Parse the MML file and produce sequencer frames map.
  */
 int mml_compile(const char* content, struct seq_frame_map_t* map) {
-	int ret = mml_parse(content);
-	if (ret) {
-		return ret;
+	struct mml_parser_t* parser = mml_open();
+	if (!parser) {
+		return 1;
 	}
-	*map = frame_map;
-	return 0;
+	mml_feed(parser, content, strlen(content));
+	return mml_close(parser, map);
 }
 
 void mml_free(struct seq_frame_map_t* map) {
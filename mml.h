@@ -27,6 +27,42 @@
 /*! Manage parser errors, used to display it in pc ports */
 void mml_set_error_handler(void (*handler)(const char* err, int line, int column));
 
+/*! Streaming parser state, see `mml_open` */
+struct mml_parser_t;
+
+/*!
+ * Start the parsing of a MML file, to be passed in chunks to `mml_feed`.
+ * Returns NULL if out of memory.
+ */
+struct mml_parser_t* mml_open();
+
+/*!
+ * Parse the next `size` bytes of the MML file. The chunks can split the lines anywhere:
+ * only the incomplete line is kept in the parser.
+ * Returns non-zero in case of parse error, then the next chunks are ignored.
+ */
+int mml_feed(struct mml_parser_t* parser, const char* chunk, size_t size);
+
+/*!
+ * Ignore the notes and the commands of the channels in the `channels` bit mask (bit 0 is channel A), 
+ * e.g. when their frames are already known: their lines are skipped, and their frame lists are left empty.
+ * Call it before the first `mml_feed`.
+ */
+void mml_skip_channels(struct mml_parser_t* parser, uint32_t channels);
+
+/*!
+ * Channels referred by a line of a MML file (without the line terminator), as bit mask.
+ * The channels are selected by the uppercase letters at the beginning of the line, otherwise the line is of channel A.
+ */
+uint32_t mml_line_channels(const char* line, size_t size);
+
+/*!
+ * Parse the last line, free the parser and produce the offline set of frames by channel 
+ * (frame map, see `mml_compile`).
+ * Returns non-zero in case of parse error, and the map is not produced.
+ */
+int mml_close(struct mml_parser_t* parser, struct seq_frame_map_t* map);
+
 /*! 
  * Parse the MML file (entirely read and passed to `content`) and produce 
  * an offline set of frames by channel (frame map).
@@ -37,7 +73,7 @@ void mml_set_error_handler(void (*handler)(const char* err, int line, int column
 int mml_compile(const char* content, struct seq_frame_map_t* map);
 
 /*!
- * Free the map allocated by `mml_compile`.
+ * Free the map allocated by `mml_compile` or `mml_close`.
  */
 void mml_free(struct seq_frame_map_t* map);
 
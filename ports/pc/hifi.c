@@ -0,0 +1,124 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, band-limited preview renderer.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include "hifi.h"
+#include <math.h>
+
+/*! 
+ * PolyBLEP residual of a unit step at phase 0, for the phase `t` and the increment `dt` (< 0.5).
+ * Smooths the two samples around each edge of the square wave, instead of the alias of the hard edge.
+ */
+static double poly_blep(double t, double dt) {
+	if (t < dt) {
+		t /= dt;
+		return t + t - t * t - 1.0;
+	}
+	if (t > 1.0 - dt) {
+		t = (t - 1.0) / dt;
+		return t * t + t + t + 1.0;
+	}
+	return 0.0;
+}
+
+/*! Restart the oscillator of the voice, at the phase of the engine square wave */
+static void hifi_voice_start(struct hifi_t* hifi, const struct voice_ch_t* voice, struct hifi_voice_t* hifi_voice) {
+	hifi_voice->phase = 0;
+	hifi_voice->step = 0;
+	if (voice->wf.period) {
+		// A period of square wave is two `period` (12.4 fixed point) of engine samples
+		hifi_voice->step = (double)SYNTH_FREQ * (1 << PERIOD_FP_SCALE) / (2.0 * voice->wf.period * hifi->rate);
+		// The half period is the sign of the sample, `period_remain` the part of it left
+		double left = (double)voice->wf.period_remain / voice->wf.period;
+		hifi_voice->phase = (voice->wf.int_sample < 0 ? 0.5 : 0) + (left < 1.0 ? 1.0 - left : 0) * 0.5;
+	}
+}
+
+void hifi_start(SYNTH_CTX_PARAM_ struct hifi_t* hifi, int rate) {
+	hifi->rate = rate;
+	hifi->engine_step = (double)SYNTH_FREQ / rate;
+	// Run the first engine sample before the first output
+	hifi->engine_pos = 1.0;
+	// The voices can be in the middle of a note, e.g. after a seek
+	for (uint8_t i = 0; i < VOICE_COUNT; i++) {
+		hifi_voice_start(hifi, &synth.voice[i], &hifi->voices[i]);
+	}
+}
+
+/*! Play an engine sample, and restart the oscillators of the voices fed in it */
+static void hifi_engine_sample(SYNTH_CTX_PARAM_ struct hifi_t* hifi) {
+	seq_feed_synth(SYNTH_CTX_ARG);
+	for (uint8_t i = 0; i < seq_voice_count; i++) {
+		const struct voice_ch_t* voice = &synth.voice[i];
+		// Only `adsr_config` leaves the countdown full in the first state
+		if (voice->adsr.state_counter == ADSR_STATE_INIT && voice->adsr.next_event == voice->adsr.def.time_scale) {
+			hifi_voice_start(hifi, voice, &hifi->voices[i]);
+		}
+	}
+}
+
+size_t hifi_render(SYNTH_CTX_PARAM_ struct hifi_t* hifi, int16_t* out, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		while (hifi->engine_pos >= 1.0) {
+			if (seq_end) {
+				return i;
+			}
+			hifi_engine_sample(SYNTH_CTX_ARG_ hifi);
+			hifi->engine_pos -= 1.0;
+		}
+		hifi->engine_pos += hifi->engine_step;
+
+		// Mix in the 8.8 fixed point of the engine block renderer
+		int32_t mix = 0;
+		for (uint8_t v = 0; v < seq_voice_count; v++) {
+			const struct voice_ch_t* voice = &synth.voice[v];
+			uint8_t gain = voice->adsr.gain;
+			if (gain >= 6) {
+				// As in `voice_ch_next`, the muted voices don't advance the waveform
+				continue;
+			}
+			struct hifi_voice_t* hifi_voice = &hifi->voices[v];
+			double value;
+			if (hifi_voice->step == 0) {
+				// No period: constant output
+				value = 1.0;
+			} else if (hifi_voice->step >= 0.5) {
+				// Above the Nyquist frequency of the output
+				value = 0.0;
+			} else {
+				double t = hifi_voice->phase;
+				double t_half = t < 0.5 ? t + 0.5 : t - 0.5;
+				value = (t < 0.5 ? 1.0 : -1.0) + poly_blep(t, hifi_voice->step) - poly_blep(t_half, hifi_voice->step);
+				hifi_voice->phase += hifi_voice->step;
+				if (hifi_voice->phase >= 1.0) {
+					hifi_voice->phase -= 1.0;
+				}
+			}
+			mix += (int32_t)lrint(value * voice->wf.int_amplitude * (256 >> gain));
+		}
+
+		if (mix > INT16_MAX) {
+			mix = INT16_MAX;
+		} else if (mix < INT16_MIN) {
+			mix = INT16_MIN;
+		}
+		out[i] = (int16_t)mix;
+	}
+	return count;
+}
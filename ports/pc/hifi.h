@@ -0,0 +1,55 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, band-limited preview renderer.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#ifndef _HIFI_H
+#define _HIFI_H
+
+#include "synth.h"
+
+/*! State of a voice oscillator of the renderer */
+struct hifi_voice_t {
+	/*! Position in the square wave period, from 0 to 1 */
+	double phase;
+	/*! Phase increment per output sample, 0 for a constant output */
+	double step;
+};
+
+/*!
+ * Preview renderer, not meant for microcontroller usage. The sequencer plays the stream at SYNTH_FREQ as usual, 
+ * with the same envelopes and the same feed timing, but the voices are rendered at `rate` as band-limited
+ * square waves (PolyBLEP), with the exact frequency of the 12.4 fixed-point period instead of the 
+ * sample-quantized one.
+ */
+struct hifi_t {
+	/*! Output sample rate */
+	int rate;
+	/*! Engine samples per output sample, and the position in the current engine sample */
+	double engine_step;
+	double engine_pos;
+	struct hifi_voice_t voices[VOICE_COUNT];
+};
+
+/*! Start the render of the stream started with `seq_play_stream`, from the present state of the voices */
+void hifi_start(SYNTH_CTX_PARAM_ struct hifi_t* hifi, int rate);
+
+/*! Render up to `count` samples at the output rate. Returns less than `count` at the end of the stream */
+size_t hifi_render(SYNTH_CTX_PARAM_ struct hifi_t* hifi, int16_t* out, size_t count);
+
+#endif
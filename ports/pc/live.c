@@ -0,0 +1,270 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, live input mode.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include "live.h"
+#include "synth.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*! Events queued and not yet played, must be a power of 2 */
+#define LIVE_RING_SIZE 256
+
+struct live_event_t {
+	struct seq_frame_t frame;
+	/*! When the event was read */
+	struct timespec stamp;
+};
+
+/*! Single-producer (the input thread), single-consumer (the audio loop) ring of events */
+struct live_ring_t {
+	struct live_event_t events[LIVE_RING_SIZE];
+	/*! Free running counters: the consumer owns `head`, the producer owns `tail` */
+	atomic_size_t head;
+	atomic_size_t tail;
+	/*! Set by the producer at the end of the input */
+	atomic_int input_end;
+};
+
+struct live_input_t {
+	struct live_ring_t* ring;
+	const struct live_config_t* config;
+};
+
+/*! Queue an event. Returns 0 if the ring is full */
+static int ring_push(struct live_ring_t* ring, const struct live_event_t* event) {
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LIVE_RING_SIZE) {
+		return 0;
+	}
+	ring->events[tail & (LIVE_RING_SIZE - 1)] = *event;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return 1;
+}
+
+/*! Oldest event of the ring, NULL if empty. It stays queued until `ring_pop` */
+static struct live_event_t* ring_peek(struct live_ring_t* ring) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+		return NULL;
+	}
+	return &ring->events[head & (LIVE_RING_SIZE - 1)];
+}
+
+static void ring_pop(struct live_ring_t* ring) {
+	atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+static double elapsed_ms(const struct timespec* from, const struct timespec* to) {
+	return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+/*! Frame of a note, with the MML normal articulation */
+static void note_frame(struct seq_frame_t* frame, int key, int velocity, int ms) {
+	voice_wf_setup_def(frame, (uint16_t)(440.0 * pow(2, (key - 69) / 12.0)), velocity / 2);
+	long time_scale = lround(ms * (double)synth_freq / 1000 / ADSR_TIME_UNITS);
+	if (time_scale < 1) {
+		time_scale = 1;
+	} else if (time_scale > TIME_SCALE_MAX) {
+		time_scale = TIME_SCALE_MAX;
+	}
+	frame->adsr_time_scale_1 = time_scale - 1;
+	frame->adsr_release_start = ADSR_TIME_UNITS * 7 / 8 - 1;
+}
+
+static void queue_note(struct live_input_t* input, int key, int velocity, int ms) {
+	struct live_event_t event;
+	clock_gettime(CLOCK_MONOTONIC, &event.stamp);
+	note_frame(&event.frame, key, velocity, ms);
+	if (!ring_push(input->ring, &event)) {
+		fprintf(stderr, "Live events overflow, note %d dropped\n", key);
+	}
+}
+
+/*! Lines of `KEY [VELOCITY [MS]]`. Empty lines and # comments are skipped */
+static void read_text(struct live_input_t* input) {
+	char line[256];
+	while (fgets(line, sizeof(line), input->config->input)) {
+		int key, velocity = 127, ms = input->config->note_ms;
+		char* comment = strchr(line, '#');
+		if (comment) {
+			*comment = 0;
+		}
+		int fields = sscanf(line, "%d %d %d", &key, &velocity, &ms);
+		if (fields <= 0) {
+			continue;
+		}
+		if (key < 0 || key > 127 || velocity < 0 || velocity > 127 || ms <= 0) {
+			fprintf(stderr, "Invalid live note: %s", line);
+			continue;
+		}
+		queue_note(input, key, velocity, ms);
+	}
+}
+
+/*! Raw MIDI bytes, with running status */
+static void read_midi(struct live_input_t* input) {
+	FILE* fp = input->config->input;
+	int status = 0;
+	int data[2];
+	int data_count = 0;
+	int c;
+	while ((c = getc(fp)) != EOF) {
+		if (c >= 0xf8) {
+			// System real-time, can be anywhere
+			continue;
+		}
+		if (c & 0x80) {
+			// System common messages and SysEx cancel the running status
+			status = c < 0xf0 ? c : 0;
+			data_count = 0;
+			continue;
+		}
+		if (!status) {
+			continue;
+		}
+		data[data_count++] = c;
+		// Program Change and Channel Pressure have one data byte
+		int length = ((status & 0xf0) == 0xc0 || (status & 0xf0) == 0xd0) ? 1 : 2;
+		if (data_count < length) {
+			continue;
+		}
+		data_count = 0;
+		// Note On with velocity 0 is a Note Off. The notes have a fixed envelope, so the Note Off are ignored
+		if ((status & 0xf0) == 0x90 && data[1] > 0) {
+			queue_note(input, data[0], data[1], input->config->note_ms);
+		}
+	}
+}
+
+static void* input_thread(void* arg) {
+	struct live_input_t* input = arg;
+	if (input->config->input_type == LIVE_INPUT_MIDI) {
+		read_midi(input);
+	} else {
+		read_text(input);
+	}
+	atomic_store_explicit(&input->ring->input_end, 1, memory_order_release);
+	return NULL;
+}
+
+int live_run(SYNTH_CTX_PARAM_ const struct live_config_t* config) {
+	static struct live_ring_t ring;
+	atomic_init(&ring.head, 0);
+	atomic_init(&ring.tail, 0);
+	atomic_init(&ring.input_end, 0);
+	struct live_input_t input = { &ring, config };
+
+	int16_t* buffer = malloc(config->block_size * sizeof(int16_t));
+	if (!buffer) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	if (config->input_type == LIVE_INPUT_MIDI) {
+		// Read the messages as soon as they arrive
+		setvbuf(config->input, NULL, _IONBF, 0);
+	}
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, input_thread, &input)) {
+		fprintf(stderr, "Cannot start the live input thread\n");
+		free(buffer);
+		return 1;
+	}
+
+	memset(synth.voice, 0, sizeof(synth.voice));
+	seq_play_stream(SYNTH_CTX_ARG_ config->voice_count);
+
+	// Events started by the block being rendered, to measure their latency at the block output
+	struct timespec stamps[VOICE_COUNT];
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	double latency_min = 0, latency_max = 0, latency_sum = 0;
+	int note_count = 0;
+	long long block_count = 0;
+
+	while (1) {
+		int started = 0;
+		struct live_event_t* event;
+		while ((event = ring_peek(&ring))) {
+			uint8_t i = 0;
+			while (i < seq_voice_count && synth.voice[i].adsr.state_counter != ADSR_STATE_END) {
+				i++;
+			}
+			if (i == seq_voice_count) {
+				// All busy: wait for the first voice to end, as the stream frames do
+				break;
+			}
+			cur_voice = &synth.voice[i];
+			voice_wf_set(SYNTH_CTX_ARG_ &event->frame);
+			adsr_config(SYNTH_CTX_ARG_ &event->frame);
+			stamps[started++] = event->stamp;
+			ring_pop(&ring);
+		}
+
+		if (!started && !event && atomic_load_explicit(&ring.input_end, memory_order_acquire)) {
+			uint8_t i = 0;
+			while (i < seq_voice_count && synth.voice[i].adsr.state_counter == ADSR_STATE_END) {
+				i++;
+			}
+			if (i == seq_voice_count) {
+				break;
+			}
+		}
+
+		seq_render_voices(SYNTH_CTX_ARG_ buffer, config->block_size);
+		config->play(buffer, config->block_size);
+		block_count++;
+		// The output of the block, including the device buffering if `play` waits for it
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (int i = 0; i < started; i++) {
+			double latency = elapsed_ms(&stamps[i], &now);
+			if (!note_count || latency < latency_min) {
+				latency_min = latency;
+			}
+			if (latency > latency_max) {
+				latency_max = latency;
+			}
+			latency_sum += latency;
+			note_count++;
+		}
+		if (config->paced) {
+			// Deadline of the next block, from the start to not accumulate errors
+			long long ns = block_count * (long long)config->block_size * 1000000000LL / synth_freq;
+			struct timespec deadline = { start.tv_sec + ns / 1000000000LL, start.tv_nsec + ns % 1000000000LL };
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+		}
+
+	}
+
+	pthread_join(thread, NULL);
+	free(buffer);
+	printf("Live stats:\n\tblock %d samples (%.1f ms)\n", (int)config->block_size, config->block_size * 1000.0 / synth_freq);
+	if (note_count) {
+		printf("\t%d notes, latency from input to block output min %.2f ms, avg %.2f ms, max %.2f ms\n", note_count, latency_min, latency_sum / note_count, latency_max);
+	}
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, live input mode.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+#ifndef _LIVE_H
+#define _LIVE_H
+
+#include "sequencer.h"
+#include <stdio.h>
+
+/*! Format of the live events */
+#define LIVE_INPUT_TEXT 0
+#define LIVE_INPUT_MIDI 1
+
+/*! Options of `live_run` */
+struct live_config_t {
+	/*! 
+	 * Source of the note events. LIVE_INPUT_TEXT is a line per note, `KEY [VELOCITY [MS]]` with MIDI key 
+	 * numbers (e.g. stdin). LIVE_INPUT_MIDI is a raw MIDI byte stream (e.g. /dev/snd/midiC1D0), of which only 
+	 * the Note On messages are played.
+	 */
+	FILE* input;
+	int input_type;
+	/*! Samples rendered between two drains of the events */
+	size_t block_size;
+	/*! Voices playing the events */
+	uint8_t voice_count;
+	/*! Duration of the notes without one, in ms */
+	int note_ms;
+	/*! Output of the blocks. If it doesn't block for the block duration (e.g. not an audio device), set `paced` */
+	void (*play)(int16_t* buffer, size_t count);
+	int paced;
+};
+
+/*!
+ * Play the note events of the input as soon as they are read, until the input ends.
+ * A thread reads the input and queues the events in a lock-free ring, that is drained at every block: 
+ * every event goes to the first voice at the end of the envelope, as in `seq_feed_synth`.
+ * Prints the latency from the reading of the events to the output of their blocks.
+ */
+int live_run(SYNTH_CTX_PARAM_ const struct live_config_t* config);
+
+#endif
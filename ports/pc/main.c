@@ -22,102 +22,1285 @@
 #include "sequencer.h"
 #include "mml.h"
 #include "codegen.h"
+#include "render_simd.h"
+#include "pool.h"
+#include "wav.h"
+#include "live.h"
+#include "pipeline.h"
+#include "hifi.h"
+#include "mml_cache.h"
+#include <errno.h>
+#include <glob.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef NO_AO
 #include <ao/ao.h>
+#endif
 
-struct poly_synth_t synth;
+/*! Frame fields, in stream order */
+enum {
+	FIELD_ADSR_TIME_SCALE,
+	FIELD_WF_PERIOD,
+	FIELD_WF_AMPLITUDE,
+	FIELD_ADSR_RELEASE_START,
+	FIELD_COUNT
+};
+
+/*! Reader of the compressed frame stream, see `new_frame_require` */
+struct stream_reader_t {
+	struct bit_stream_t bit_stream;
+	/*! Bit position of the next frame */
+	size_t bit_pos;
+	/*! Bits from a frame to the next one */
+	int frame_stride;
+	/*! Position of the fields in a frame, set by `start_stream` */
+	uint8_t shifts[FIELD_COUNT];
+	uint32_t masks[FIELD_COUNT];
+	/*! STREAM_COUNTED_END: frames left */
+	int frames_left;
+	/*! STREAM_PATTERNS: frames left in the call, and the position after the call */
+	int call_left;
+	size_t return_pos;
+	/*! Bits read by `read_code` and `read_bits` for the last frame, for the cost model */
+	int bits_read;
+	/*! Frames decoded since `reader_init`, terminator excluded */
+	int frames_read;
+};
+
+/* Layout of the compiled streams, set by the command line */
+static int stream_flags = STREAM_PERIOD_DELTA;
+
+/* Scale down the tunes that clip, see `seq_gain_stage`. Cleared by `--clip` */
+static int gain_staging = 1;
+
+static struct synth_ctx_t engine;
+static struct stream_reader_t reader;
 
 static int16_t samples[8192];
-static uint16_t samples_sz = 0;
-static struct bit_stream_t bit_stream;
-static int stream_pos;
-static int stream_pos_bit;
+static size_t samples_sz = 0;
+
+/* File parsed by the thread, for the error messages */
+static __thread const char* mml_file_name;
 
 /* Read and play a MML file */
 static void mml_error(const char* err, int line, int column) {
-	fprintf(stderr, "Error reading MML file: %s at line %d, pos %d\n", err, line, column);
+	fprintf(stderr, "Error reading MML file %s: %s at line %d, pos %d\n", mml_file_name, err, line, column);
 }
 
-static int process_mml(const char* name, int* voice_count) {
+/* Directory of the parsed channels cache, see `mml_cache_open` */
+static const char* mml_cache_dir;
+
+static int parse_mml(const char* name, struct seq_frame_map_t* map) {
 	FILE *fp = fopen(name, "r");
 	if (!fp) {
-		fprintf(stderr, "Error reading MML file: %s", name);
+		fprintf(stderr, "Error reading MML file: %s\n", name);
+		return 1;
+	}
+	struct mml_cache_t cache;
+	if (mml_cache_dir && mml_cache_open(&cache, mml_cache_dir, fp)) {
+		fclose(fp);
+		fprintf(stderr, "Error reading MML file: %s\n", name);
 		return 1;
 	}
-	fseek(fp, 0, SEEK_END);
-	long size = ftell(fp);
-   	char* content = malloc(size + 1);
-	fseek(fp, 0, SEEK_SET);
-	fread(content, 1, size, fp);
-	content[size] = 0;
 
-	mml_set_error_handler(mml_error);
-	int err;
+	// Stream the file to the parser, so only the current line is kept in memory
+	mml_file_name = name;
+	struct mml_parser_t* parser = mml_open();
+	if (!parser) {
+		fclose(fp);
+		if (mml_cache_dir) {
+			mml_cache_close(&cache, NULL);
+		}
+		fprintf(stderr, "Out of memory reading MML file: %s\n", name);
+		return 1;
+	}
+	if (mml_cache_dir) {
+		// Only the edited channels are parsed
+		mml_skip_channels(parser, cache.cached);
+	}
+	char chunk[4096];
+	size_t size;
+	while ((size = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+		if (mml_feed(parser, chunk, size)) {
+			break;
+		}
+	}
+	fclose(fp);
+	int err = mml_close(parser, map);
+	if (mml_cache_dir) {
+		mml_cache_close(&cache, err ? NULL : map);
+	}
+	return err;
+}
 
+/* Compile a MML file to the bit-stream of the port reader */
+static int compile_mml(SYNTH_CTX_PARAM_ const char* name, int* voice_count, int* channel_count, int* do_clip_check) {
+	int err;
 	struct seq_frame_map_t map;
-	err = mml_compile(content, &map);
+	err = parse_mml(name, &map);
 	if (err) {
 		return err;
 	}
-	free(content);
-	int channel_count = map.channel_count;
+	*channel_count = map.channel_count;
 
 	// Sort frames in stream
-	int do_clip_check;
 	struct seq_frame_t* seq_frame_stream;
-	int current_frame;
 	int frame_count;
-	seq_compile(&map, &seq_frame_stream, &frame_count, voice_count, &do_clip_check);
+	seq_compile(SYNTH_CTX_ARG_ &map, &seq_frame_stream, &frame_count, voice_count, SEQ_COMPILE_FAST);
 	mml_free(&map);
+	int peak;
+	*do_clip_check = seq_mix_peak(SYNTH_CTX_ARG_ seq_frame_stream, frame_count, *voice_count, &peak) != 0;
+	if (*do_clip_check && gain_staging) {
+		*do_clip_check = seq_gain_stage(SYNTH_CTX_ARG_ seq_frame_stream, frame_count, *voice_count, peak) != 0;
+	}
 
 	// Compress stream
-	if (stream_compress(seq_frame_stream, frame_count, &bit_stream)) {
+	struct stream_reader_t* reader = ctx->port;
+	err = stream_compress(seq_frame_stream, frame_count, *voice_count, &reader->bit_stream, stream_flags);
+	seq_free(seq_frame_stream);
+	return err;
+}
+
+static void start_stream(SYNTH_CTX_PARAM_ int voice_count);
+static int render_hifi(SYNTH_CTX_PARAM_ struct wav_writer_t* writer, int rate);
+#ifdef PROFILE_CYCLES
+static uint32_t profile_stream(SYNTH_CTX_PARAM_ const char* name, int voice_count, int do_clip_check, int histogram);
+#endif
+
+/* Compile a MML file to the `tune_gen.c`/`tune_gen.h` files in `out_dir`, and keep the bit-stream in the port reader */
+static int process_mml(SYNTH_CTX_PARAM_ const char* name, const char* out_dir, int* voice_count) {
+	int channel_count;
+	int do_clip_check;
+	if (compile_mml(SYNTH_CTX_ARG_ name, voice_count, &channel_count, &do_clip_check)) {
+		return 1;
+	}
+	struct stream_reader_t* reader = ctx->port;
+#ifdef PROFILE_CYCLES
+	profile_stream(SYNTH_CTX_ARG_ name, *voice_count, do_clip_check, 0);
+#endif
+	// The empty channels have no voice: SEQ_CHANNEL_COUNT is the count of the voices the stream is compiled for
+	return codegen_write(name, out_dir, &reader->bit_stream, *voice_count, do_clip_check);
+}
+
+/* Compile the MML file in both the compiler modes, and check that the output is the same */
+static int check_compile(SYNTH_CTX_PARAM_ const char* name) {
+	struct seq_frame_map_t map;
+	if (parse_mml(name, &map)) {
+		return 1;
+	}
+
+	struct seq_frame_t* streams[2];
+	int frame_counts[2];
+	int voice_counts[2];
+	seq_compile(SYNTH_CTX_ARG_ &map, &streams[0], &frame_counts[0], &voice_counts[0], SEQ_COMPILE_SAMPLES);
+	seq_compile(SYNTH_CTX_ARG_ &map, &streams[1], &frame_counts[1], &voice_counts[1], SEQ_COMPILE_FAST);
+	mml_free(&map);
+
+	int ret = frame_counts[0] != frame_counts[1] || voice_counts[0] != voice_counts[1] ||
+		memcmp(streams[0], streams[1], sizeof(struct seq_frame_t) * frame_counts[0]);
+	printf("%s: %s\n", name, ret ? "FAILED, the compiler modes differ" : "OK");
+
+	seq_free(streams[0]);
+	seq_free(streams[1]);
+	return ret;
+}
+
+/* A tune of `compile-batch` */
+struct batch_tune_t {
+	const char* name;
+	char out_dir[4096];
+	int err;
+	int voice_count;
+	int data_size;
+};
+
+struct batch_t {
+	struct batch_tune_t* tunes;
+	int count;
+	/*! Sample rate of the `preview.wav` of each tune, rendered with `hifi_render`. 0 for no preview */
+	int preview_rate;
+};
+
+static int make_dir(const char* path) {
+	if (mkdir(path, 0777) && errno != EEXIST) {
+		fprintf(stderr, "Cannot create the %s folder\n", path);
+		return 1;
+	}
+	return 0;
+}
+
+/* Pool task: compile a tune with its own engine instance */
+static void batch_compile_tune(int i, void* user) {
+	struct batch_tune_t* tune = &((struct batch_t*)user)->tunes[i];
+	struct synth_ctx_t tune_ctx;
+	struct stream_reader_t tune_reader;
+	memset(&tune_ctx, 0, sizeof(tune_ctx));
+	memset(&tune_reader, 0, sizeof(tune_reader));
+	tune_ctx.port = &tune_reader;
+
+	int preview_rate = ((struct batch_t*)user)->preview_rate;
+	tune->err = make_dir(tune->out_dir) || process_mml(&tune_ctx, tune->name, tune->out_dir, &tune->voice_count);
+	if (!tune->err && preview_rate) {
+		char path[4096 + 16];
+		struct wav_writer_t writer;
+		snprintf(path, sizeof(path), "%s/preview.wav", tune->out_dir);
+		tune->err = wav_open(&writer, path, preview_rate, 0);
+		if (!tune->err) {
+			start_stream(&tune_ctx, tune->voice_count);
+			tune->err = render_hifi(&tune_ctx, &writer, preview_rate);
+			tune->err |= wav_close(&writer);
+		}
+		if (tune->err) {
+			fprintf(stderr, "Cannot write the %s file\n", path);
+			stream_free(&tune_reader.bit_stream);
+		}
+	}
+	if (!tune->err) {
+		tune->data_size = tune_reader.bit_stream.data_size;
+		stream_free(&tune_reader.bit_stream);
+		printf("%s: %d voices, %d bytes -> %s\n", tune->name, tune->voice_count, tune->data_size, tune->out_dir);
+	} else {
+		printf("%s: FAILED\n", tune->name);
+	}
+}
+
+/* Add a file name, or the files matching a glob pattern */
+static void batch_add(struct batch_t* batch, const char* out_dir, const char* pattern, glob_t* globs) {
+	const char* const* names = &pattern;
+	size_t count = 1;
+	if (strpbrk(pattern, "*?[")) {
+		if (glob(pattern, 0, NULL, globs)) {
+			fprintf(stderr, "No files matching %s\n", pattern);
+			return;
+		}
+		names = (const char* const*)globs->gl_pathv;
+		count = globs->gl_pathc;
+	}
+
+	batch->tunes = realloc(batch->tunes, sizeof(struct batch_tune_t) * (batch->count + count));
+	for (size_t i = 0; i < count; i++) {
+		struct batch_tune_t* tune = &batch->tunes[batch->count];
+		memset(tune, 0, sizeof(struct batch_tune_t));
+		tune->name = names[i];
+
+		// Output folder named as the file, without path and extension
+		const char* base = strrchr(tune->name, '/');
+		base = base ? base + 1 : tune->name;
+		const char* ext = strrchr(base, '.');
+		int base_len = ext ? (int)(ext - base) : (int)strlen(base);
+		snprintf(tune->out_dir, sizeof(tune->out_dir), "%s/%.*s", out_dir, base_len, base);
+
+		// Two workers can't write the same files
+		int j = 0;
+		while (j < batch->count && strcmp(batch->tunes[j].out_dir, tune->out_dir)) {
+			j++;
+		}
+		if (j < batch->count) {
+			fprintf(stderr, "Skipping %s, same output folder of %s\n", tune->name, batch->tunes[j].name);
+			continue;
+		}
+		batch->count++;
+	}
+}
+
+/* 
+ * Compile all the files to `out_dir/NAME/tune_gen.c|h` on `thread_count` worker threads, with the `preview.wav`
+ * at `preview_rate` when not 0. Returns the failed count 
+ */
+static int compile_batch(const char* out_dir, int thread_count, int preview_rate, int file_count, char** files) {
+	if (make_dir(out_dir)) {
 		return 1;
 	}
-	
-	return codegen_write(name, &bit_stream, channel_count, do_clip_check);
+
+	struct batch_t batch = { NULL, 0, preview_rate };
+	glob_t* globs = malloc(sizeof(glob_t) * (file_count ? file_count : 1));
+	memset(globs, 0, sizeof(glob_t) * (file_count ? file_count : 1));
+	for (int i = 0; i < file_count; i++) {
+		batch_add(&batch, out_dir, files[i], &globs[i]);
+	}
+
+	// The per-tune summary replaces the stats, that would be mixed up between threads
+	seq_verbose = 0;
+	pool_run(thread_count, batch.count, batch_compile_tune, &batch);
+	seq_verbose = 1;
+
+	int failed = 0;
+	for (int i = 0; i < batch.count; i++) {
+		failed += batch.tunes[i].err;
+	}
+	printf("%d tunes compiled, %d failed\n", batch.count - failed, failed);
+
+	for (int i = 0; i < file_count; i++) {
+		globfree(&globs[i]);
+	}
+	free(globs);
+	free(batch.tunes);
+	return failed;
+}
+
+/* 
+ * Add silent channels to the map, up to `voice_count` channels with frames: all the tunes of a pack are played 
+ * on SEQ_CHANNEL_COUNT voices, and a stream only plays right on the voice count it is compiled for.
+ * The pauses have the longest time scale of the tune, to take few feeds, and last up to the longest channel.
+ */
+static void pad_channels(struct seq_frame_map_t* map, int voice_count) {
+	int valid_count = 0;
+	uint32_t duration = 0;
+	struct seq_frame_t pause = { 0, 0, 0, 0 };
+	for (int i = 0; i < map->channel_count; i++) {
+		const struct seq_frame_list_t* list = &map->channels[i];
+		if (!list->count) {
+			continue;
+		}
+		valid_count++;
+		uint32_t channel_duration = 0;
+		for (int j = 0; j < list->count; j++) {
+			channel_duration += ADSR_ENV_SAMPLES(list->frames[j].adsr_time_scale_1);
+			if (list->frames[j].adsr_time_scale_1 > pause.adsr_time_scale_1) {
+				pause.adsr_time_scale_1 = list->frames[j].adsr_time_scale_1;
+				pause.adsr_release_start = list->frames[j].adsr_release_start;
+			}
+		}
+		if (channel_duration > duration) {
+			duration = channel_duration;
+		}
+	}
+	if (valid_count >= voice_count) {
+		return;
+	}
+
+	// Up to the end of the longest channel at least, or the first voice left without frames stops the others
+	uint32_t pause_samples = ADSR_ENV_SAMPLES(pause.adsr_time_scale_1);
+	int pause_count = (duration + pause_samples - 1) / pause_samples;
+	if (!pause_count) {
+		pause_count = 1;
+	}
+	int channel_count = map->channel_count + voice_count - valid_count;
+	map->channels = realloc(map->channels, sizeof(struct seq_frame_list_t) * channel_count);
+	for (int i = map->channel_count; i < channel_count; i++) {
+		map->channels[i].count = pause_count;
+		map->channels[i].frames = malloc(sizeof(struct seq_frame_t) * pause_count);
+		for (int j = 0; j < pause_count; j++) {
+			map->channels[i].frames[j] = pause;
+		}
+	}
+	map->channel_count = channel_count;
 }
 
-static uint8_t read_bits(uint8_t bits) {
-	if (bits) {
-		uint16_t buffer = bit_stream.data[stream_pos] + (bit_stream.data[stream_pos + 1] << 8);
-		buffer >>= stream_pos_bit;
-		uint8_t ret = buffer & ((1 << bits) - 1);
+/* 
+ * Compile the MML files together to `tune_gen.c`/`tune_gen.h` in the current folder, with the ref tables shared 
+ * by the tunes and a directory of the tunes (see `stream_compress_pack`). The tunes are played on the voices of the largest one.
+ */
+static int compile_pack(SYNTH_CTX_PARAM_ int file_count, char** files) {
+	if (!file_count) {
+		fprintf(stderr, "No tunes to pack\n");
+		return 1;
+	}
+	struct seq_frame_map_t* maps = malloc(sizeof(struct seq_frame_map_t) * file_count);
+	struct seq_frame_t** frame_streams = malloc(sizeof(struct seq_frame_t*) * file_count);
+	int* frame_counts = malloc(sizeof(int) * file_count);
+	int* tune_voices = malloc(sizeof(int) * file_count);
+	int parsed = 0;
+	int streams = 0;
+	int err = 0;
+	int voice_count = 0;
+	for (; parsed < file_count; parsed++) {
+		if (parse_mml(files[parsed], &maps[parsed])) {
+			err = 1;
+			break;
+		}
+		tune_voices[parsed] = 0;
+		for (int i = 0; i < maps[parsed].channel_count; i++) {
+			tune_voices[parsed] += maps[parsed].channels[i].count > 0;
+		}
+		if (tune_voices[parsed] > voice_count) {
+			voice_count = tune_voices[parsed];
+		}
+	}
+
+	// The names of the tunes, in pack order, for the generated code
+	size_t names_size = 1;
+	for (int i = 0; i < file_count; i++) {
+		names_size += strlen(files[i]) + 2;
+	}
+	char* names = malloc(names_size);
+	names[0] = 0;
 
-		stream_pos_bit += bits;
-		if (stream_pos_bit >= 8) {
-			stream_pos_bit -= 8;
-			stream_pos++;
+	int do_clip_check = 0;
+	for (; !err && streams < file_count; streams++) {
+		pad_channels(&maps[streams], voice_count);
+		int tune_voice_count;
+		seq_compile(SYNTH_CTX_ARG_ &maps[streams], &frame_streams[streams], &frame_counts[streams], &tune_voice_count, SEQ_COMPILE_FAST);
+		int peak;
+		int tune_clip_check = seq_mix_peak(SYNTH_CTX_ARG_ frame_streams[streams], frame_counts[streams], tune_voice_count, &peak) != 0;
+		if (tune_clip_check && gain_staging) {
+			tune_clip_check = seq_gain_stage(SYNTH_CTX_ARG_ frame_streams[streams], frame_counts[streams], tune_voice_count, peak) != 0;
 		}
+		do_clip_check |= tune_clip_check;
+		strcat(names, streams ? ", " : "");
+		strcat(names, files[streams]);
+	}
 
-		return ret;
+	struct stream_reader_t* reader = ctx->port;
+	if (!err) {
+		err = stream_compress_pack(frame_streams, frame_counts, file_count, voice_count, &reader->bit_stream, stream_flags);
+	}
+	if (!err) {
+		const struct bit_stream_t* bit_stream = &reader->bit_stream;
+		for (int i = 0; i < file_count; i++) {
+			printf("%s: %d voices%s, %d frames, %d bytes at %d\n", files[i], tune_voices[i], tune_voices[i] < voice_count ? " (padded)" : "",
+				frame_counts[i], bit_stream->tune_offsets[i + 1] - bit_stream->tune_offsets[i], bit_stream->tune_offsets[i]);
+		}
+		printf("Pack: %d tunes on %d voices, %d bytes\n", file_count, voice_count, bit_stream->data_size);
+		err = codegen_write(names, NULL, &reader->bit_stream, voice_count, do_clip_check);
+		stream_free(&reader->bit_stream);
+	}
+
+	for (int i = 0; i < streams; i++) {
+		seq_free(frame_streams[i]);
+	}
+	for (int i = 0; i < parsed; i++) {
+		mml_free(&maps[i]);
+	}
+	free(names);
+	free(tune_voices);
+	free(frame_counts);
+	free(frame_streams);
+	free(maps);
+	return err;
+}
+
+/* The refs of the period field: the intervals for STREAM_PERIOD_DELTA */
+static const struct ref_map_t* period_field(const struct bit_stream_t* bit_stream) {
+	return (bit_stream->flags & STREAM_PERIOD_DELTA) ? &bit_stream->refs_wf_period_delta : &bit_stream->refs_wf_period;
+}
+
+/* Period of the period field ref, for the voice being fed */
+static uint16_t period_value(SYNTH_CTX_PARAM_ const struct bit_stream_t* bit_stream, uint8_t ref) {
+	if (bit_stream->flags & STREAM_PERIOD_DELTA) {
+		cur_voice->period_ref += bit_stream->refs_wf_period_delta.values[ref];
+		ref = cur_voice->period_ref;
+	}
+	return bit_stream->refs_wf_period.values[ref];
+}
+
+/* Set up the field shifts and masks of the stream layout */
+static void reader_init(struct stream_reader_t* reader) {
+	const struct bit_stream_t* bit_stream = &reader->bit_stream;
+	const int bits[FIELD_COUNT] = {
+		bit_stream->refs_adsr_time_scale.bit_count,
+		period_field(bit_stream)->bit_count,
+		bit_stream->refs_wf_amplitude.bit_count,
+		bit_stream->refs_adsr_release_start.bit_count
+	};
+	int shift = 0;
+	for (int i = 0; i < FIELD_COUNT; i++) {
+		reader->shifts[i] = shift;
+		reader->masks[i] = (1u << bits[i]) - 1;
+		shift += bits[i];
+	}
+	reader->frame_stride = (bit_stream->flags & STREAM_BYTE_ALIGNED) ? bit_stream->frame_bytes * 8 : bit_stream->frame_bits;
+	reader->bit_pos = 0;
+	reader->frames_left = bit_stream->frame_count;
+	reader->call_left = 0;
+	reader->frames_read = 0;
+}
+
+/* Read a canonical Huffman code, MSB first, and return the ref */
+static uint8_t read_code(struct stream_reader_t* reader, const struct ref_map_t* refs) {
+	const uint8_t* data = reader->bit_stream.data;
+	int code = 0;
+	// First code of the current length, and its ref
+	int first = 0;
+	int ref = 0;
+	for (int length = 0; length < refs->code_bits; length++) {
+		code |= (data[reader->bit_pos >> 3] >> (reader->bit_pos & 7)) & 1;
+		reader->bit_pos++;
+		reader->bits_read++;
+		int count = refs->code_counts[length];
+		if (code - first < count) {
+			return ref + code - first;
+		}
+		ref += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	// Single value
+	return 0;
+}
+
+static void new_frame_huffman(SYNTH_CTX_PARAM) {
+	struct stream_reader_t* reader = ctx->port;
+	const struct bit_stream_t* bit_stream = &reader->bit_stream;
+	seq_buf_frame.adsr_time_scale_1 = bit_stream->refs_adsr_time_scale.values[read_code(reader, &bit_stream->refs_adsr_time_scale)];
+	seq_buf_frame.wf_period = period_value(SYNTH_CTX_ARG_ bit_stream, read_code(reader, period_field(bit_stream)));
+	seq_buf_frame.wf_amplitude = bit_stream->refs_wf_amplitude.values[read_code(reader, &bit_stream->refs_wf_amplitude)];
+	seq_buf_frame.adsr_release_start = bit_stream->refs_adsr_release_start.values[read_code(reader, &bit_stream->refs_adsr_release_start)];
+}
+
+/* Read up to 32 bits, LSB first */
+static uint32_t read_bits(struct stream_reader_t* reader, int bits) {
+	uint64_t word;
+	memcpy(&word, reader->bit_stream.data + (reader->bit_pos >> 3), sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	word >>= reader->bit_pos & 7;
+	reader->bit_pos += bits;
+	reader->bits_read += bits;
+	return (uint32_t)(word & ((1ull << bits) - 1));
+}
+
+/* A frame of a STREAM_PATTERNS stream, or the first frame of a call */
+static void new_frame_patterns(SYNTH_CTX_PARAM) {
+	struct stream_reader_t* reader = ctx->port;
+	const struct bit_stream_t* bit_stream = &reader->bit_stream;
+	uint8_t ref_adsr_time_scale = read_bits(reader, bit_stream->refs_adsr_time_scale.bit_count);
+	if (ref_adsr_time_scale == bit_stream->refs_adsr_time_scale.count) {
+		// The called frames are never calls
+		size_t pos = read_bits(reader, bit_stream->pattern_ptr_bits);
+		reader->call_left = read_bits(reader, bit_stream->pattern_len_bits) + STREAM_PATTERN_MIN_LEN;
+		reader->return_pos = reader->bit_pos;
+		reader->bit_pos = pos;
+		ref_adsr_time_scale = read_bits(reader, bit_stream->refs_adsr_time_scale.bit_count);
+	}
+	uint8_t ref_wf_period = read_bits(reader, period_field(bit_stream)->bit_count);
+	uint8_t ref_wf_amplitude = read_bits(reader, bit_stream->refs_wf_amplitude.bit_count);
+	uint8_t ref_adsr_release_start = read_bits(reader, bit_stream->refs_adsr_release_start.bit_count);
+	if (reader->call_left && !--reader->call_left) {
+		reader->bit_pos = reader->return_pos;
+	}
+
+	seq_buf_frame.adsr_time_scale_1 = bit_stream->refs_adsr_time_scale.values[ref_adsr_time_scale];
+	seq_buf_frame.wf_period = period_value(SYNTH_CTX_ARG_ bit_stream, ref_wf_period);
+	seq_buf_frame.wf_amplitude = bit_stream->refs_wf_amplitude.values[ref_wf_amplitude];
+	seq_buf_frame.adsr_release_start = bit_stream->refs_adsr_release_start.values[ref_adsr_release_start];
+}
+
+/* 
+ * Fetch the whole frame with one unaligned load: the frame is at most 32 bits,
+ * and with the bit offset it fits in 40. The stream padding covers the end.
+ */
+static uint64_t read_frame(struct stream_reader_t* reader) {
+	uint64_t word;
+	memcpy(&word, reader->bit_stream.data + (reader->bit_pos >> 3), sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	word >>= reader->bit_pos & 7;
+	reader->bit_pos += reader->frame_stride;
+	return word;
+}
+
+static void new_frame_read(SYNTH_CTX_PARAM) {
+	struct stream_reader_t* reader = ctx->port;
+	const struct bit_stream_t* bit_stream = &reader->bit_stream;
+	if (STREAM_COUNTED_END(bit_stream->flags)) {
+		if (!reader->frames_left) {
+			seq_buf_frame.adsr_time_scale_1 = 0;
+			return;
+		}
+		reader->frames_left--;
+	}
+	if (bit_stream->flags & STREAM_HUFFMAN) {
+		new_frame_huffman(SYNTH_CTX_ARG);
+		return;
+	}
+	if (bit_stream->flags & STREAM_PATTERNS) {
+		new_frame_patterns(SYNTH_CTX_ARG);
+		return;
+	}
+	uint64_t frame = read_frame(reader);
+	uint8_t ref_adsr_time_scale = (frame >> reader->shifts[FIELD_ADSR_TIME_SCALE]) & reader->masks[FIELD_ADSR_TIME_SCALE];
+	uint8_t ref_wf_period = (frame >> reader->shifts[FIELD_WF_PERIOD]) & reader->masks[FIELD_WF_PERIOD];
+	uint8_t ref_wf_amplitude = (frame >> reader->shifts[FIELD_WF_AMPLITUDE]) & reader->masks[FIELD_WF_AMPLITUDE];
+	uint8_t ref_adsr_release_start = (frame >> reader->shifts[FIELD_ADSR_RELEASE_START]) & reader->masks[FIELD_ADSR_RELEASE_START];
+
+	// Byte position after the frame
+	int pos = (int)(reader->bit_pos >> 3);
+	int end;
+	if (STREAM_COUNTED_END(bit_stream->flags)) {
+		end = 0;
+	} else if (bit_stream->flags & STREAM_BYTE_ALIGNED) {
+		// Only the terminator frame is past the data
+		end = pos > bit_stream->data_size - bit_stream->frame_bytes;
 	} else {
+		end = pos >= (bit_stream->data_size - 1) && !ref_adsr_time_scale && !ref_wf_period && !ref_wf_amplitude && !ref_adsr_release_start;
+	}
+	if (end) {
+		seq_buf_frame.adsr_time_scale_1 = 0;
+	} else {
+		seq_buf_frame.adsr_time_scale_1 = bit_stream->refs_adsr_time_scale.values[ref_adsr_time_scale];
+		seq_buf_frame.wf_period = period_value(SYNTH_CTX_ARG_ bit_stream, ref_wf_period);
+		seq_buf_frame.wf_amplitude = bit_stream->refs_wf_amplitude.values[ref_wf_amplitude];
+		seq_buf_frame.adsr_release_start = bit_stream->refs_adsr_release_start.values[ref_adsr_release_start];
+	}
+}
+
+#ifdef PROFILE_CYCLES
+/* PIC cycles of the frame fetch, with the decoder that the PIC port uses for the stream layout */
+static void profile_fetch(SYNTH_CTX_PARAM_ const struct stream_reader_t* reader, size_t bit_pos) {
+	const struct bit_stream_t* bit_stream = &reader->bit_stream;
+	uint32_t cycles = FIELD_COUNT * PROFILE_COST_FETCH_FIELD;
+	if (bit_stream->flags & (STREAM_HUFFMAN | STREAM_PATTERNS)) {
+		// Generic decoder, bit by bit
+		cycles += reader->bits_read * PROFILE_COST_FETCH_BIT;
+	} else if (bit_stream->flags & STREAM_BYTE_ALIGNED) {
+		cycles += bit_stream->frame_bytes * PROFILE_COST_FETCH_BYTE;
+	} else {
+		// Generated decoder: the bytes spanned by the frame, with constant shifts
+		cycles += (((bit_pos & 7) + bit_stream->frame_bits + 7) >> 3) * PROFILE_COST_FETCH_BYTE;
+	}
+	if (bit_stream->flags & STREAM_PERIOD_DELTA) {
+		cycles += PROFILE_COST_FETCH_DELTA;
+	}
+	PROFILE_COST(cycles);
+}
+#endif
+
+void new_frame_require(SYNTH_CTX_PARAM) {
+	struct stream_reader_t* reader = ctx->port;
+#ifdef PROFILE_CYCLES
+	size_t bit_pos = reader->bit_pos;
+	reader->bits_read = 0;
+	new_frame_read(SYNTH_CTX_ARG);
+	profile_fetch(SYNTH_CTX_ARG_ reader, bit_pos);
+#else
+	new_frame_read(SYNTH_CTX_ARG);
+#endif
+	if (seq_buf_frame.adsr_time_scale_1) {
+		reader->frames_read++;
+	}
+}
+
+/* Start the playback of the stream compiled in the port reader */
+static void start_stream(SYNTH_CTX_PARAM_ int voice_count) {
+	reader_init(ctx->port);
+	seq_play_stream(SYNTH_CTX_ARG_ voice_count);
+}
+
+#ifdef PROFILE_CYCLES
+/* Width of the histogram buckets of `profile_stream`, in cycles */
+#define PROFILE_BUCKET_CYCLES 32
+#define PROFILE_BUCKETS (2 * PROFILE_SAMPLE_CYCLES / PROFILE_BUCKET_CYCLES + 1)
+
+/* 
+ * Play the stream compiled in the port reader one sample at a time, as the PIC does, and 
+ * measure the cycles of every sample with the cost model. Returns the samples over the budget.
+ */
+static uint32_t profile_stream(SYNTH_CTX_PARAM_ const char* name, int voice_count, int do_clip_check, int histogram) {
+	uint32_t buckets[PROFILE_BUCKETS];
+	memset(buckets, 0, sizeof(buckets));
+	uint32_t samples = 0;
+	uint32_t over = 0;
+	uint32_t worst = 0;
+	uint32_t worst_sample = 0;
+	uint64_t total = 0;
+
+	memset(synth.voice, 0, sizeof(synth.voice));
+	start_stream(SYNTH_CTX_ARG_ voice_count);
+	while (!seq_end) {
+		profile_cycles = do_clip_check ? PROFILE_COST_CLIP : 0;
+		seq_feed_synth(SYNTH_CTX_ARG);
+		uint32_t cycles = profile_cycles;
+		total += cycles;
+		if (cycles > worst) {
+			worst = cycles;
+			worst_sample = samples;
+		}
+		if (cycles > PROFILE_SAMPLE_CYCLES) {
+			over++;
+		}
+		uint32_t bucket = cycles / PROFILE_BUCKET_CYCLES;
+		buckets[bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1]++;
+		samples++;
+	}
+	// Leave the voices as the playback expects them
+	memset(synth.voice, 0, sizeof(synth.voice));
+
+	if (seq_verbose) {
+		printf("Profile stats:\n");
+		printf("\t%u cycles per sample available at %d Hz\n", (unsigned)PROFILE_SAMPLE_CYCLES, SYNTH_FREQ);
+		printf("\tavg %.1f cycles, worst %u cycles at %.3fs\n", samples ? (double)total / samples : 0, worst, (double)worst_sample / synth_freq);
+		if (histogram) {
+			for (uint32_t i = 0; i < PROFILE_BUCKETS; i++) {
+				if (buckets[i]) {
+					if (i < PROFILE_BUCKETS - 1) {
+						printf("\t%4u-%4u cycles: %u samples (%.2f%%)\n", i * PROFILE_BUCKET_CYCLES, (i + 1) * PROFILE_BUCKET_CYCLES - 1, buckets[i], 100.0 * buckets[i] / samples);
+					} else {
+						printf("\t%4u+     cycles: %u samples (%.2f%%)\n", i * PROFILE_BUCKET_CYCLES, buckets[i], 100.0 * buckets[i] / samples);
+					}
+				}
+			}
+		}
+	}
+	if (over) {
+		printf("\tWARN: %s misses the sample deadline in %u samples of %u, the playback will jitter\n", name, over, samples);
+	}
+	return over;
+}
+
+/* Profile the PIC cycles of a MML file */
+static int profile_mml(SYNTH_CTX_PARAM_ const char* name) {
+	int voice_count;
+	int channel_count;
+	int do_clip_check;
+	if (compile_mml(SYNTH_CTX_ARG_ name, &voice_count, &channel_count, &do_clip_check)) {
+		return 1;
+	}
+	profile_stream(SYNTH_CTX_ARG_ name, voice_count, do_clip_check, 1);
+	struct stream_reader_t* reader = ctx->port;
+	stream_free(&reader->bit_stream);
+	return 0;
+}
+#endif
+
+#ifdef SEQ_STATS
+/* File of the playback counters, set by --stats */
+static const char* stats_path;
+
+/* Write the counters of the last playback of the tune to `stats_path`, as JSON */
+static int write_stats(SYNTH_CTX_PARAM_ const char* name, int voice_count) {
+	if (!stats_path) {
 		return 0;
 	}
+	FILE* fp = fopen(stats_path, "w");
+	if (!fp) {
+		fprintf(stderr, "Cannot write the stats file %s\n", stats_path);
+		return 1;
+	}
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"tune\": \"");
+	for (const char* c = name; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', fp);
+		}
+		fputc(*c, fp);
+	}
+	fprintf(fp, "\",\n");
+	fprintf(fp, "\t\"sample_rate\": %d,\n", synth_freq);
+	fprintf(fp, "\t\"samples\": %u,\n", seq_stats.samples);
+	fprintf(fp, "\t\"frames\": %u,\n", seq_stats.frames);
+	fprintf(fp, "\t\"clipped_samples\": %u,\n", seq_stats.clipped);
+	fprintf(fp, "\t\"deferred_feeds\": %u,\n", seq_stats.deferred_feeds);
+	fprintf(fp, "\t\"adsr_samples\": { \"attack\": %u, \"sustain\": %u, \"decay\": %u, \"release\": %u, \"end\": %u },\n",
+		seq_stats.adsr_samples[ADSR_PHASE_ATTACK], seq_stats.adsr_samples[ADSR_PHASE_SUSTAIN], seq_stats.adsr_samples[ADSR_PHASE_DECAY],
+		seq_stats.adsr_samples[ADSR_PHASE_RELEASE], seq_stats.adsr_samples[ADSR_PHASE_END]);
+	fprintf(fp, "\t\"idle_samples\": [");
+	for (int i = 0; i < voice_count; i++) {
+		fprintf(fp, "%s%u", i ? ", " : " ", seq_stats.idle_samples[i]);
+	}
+	fprintf(fp, " ]\n");
+	fprintf(fp, "}\n");
+	int err = ferror(fp);
+	err |= fclose(fp);
+	if (err) {
+		fprintf(stderr, "Cannot write the stats file %s\n", stats_path);
+	}
+	return err != 0;
 }
+#endif
 
-void new_frame_require() {
-	uint8_t ref_adsr_time_scale = read_bits(bit_stream.refs_adsr_time_scale.bit_count);
-	uint8_t ref_wf_period = read_bits(bit_stream.refs_wf_period.bit_count);
-	uint8_t ref_wf_amplitude = read_bits(bit_stream.refs_wf_amplitude.bit_count);
-	uint8_t ref_adsr_release_start = read_bits(bit_stream.refs_adsr_release_start.bit_count);
+/* Render the stream started in the port reader with the preview renderer at `rate`, see `hifi_render` */
+static int render_hifi(SYNTH_CTX_PARAM_ struct wav_writer_t* writer, int rate) {
+	int16_t buffer[4096];
+	struct hifi_t hifi;
+	hifi_start(SYNTH_CTX_ARG_ &hifi, rate);
+	size_t count;
+	int err = 0;
+	do {
+		count = hifi_render(SYNTH_CTX_ARG_ &hifi, buffer, sizeof(buffer) / sizeof(int16_t));
+		err = wav_write(writer, buffer, count);
+	} while (count == sizeof(buffer) / sizeof(int16_t) && !err);
+	return err;
+}
 
-	if (stream_pos >= (bit_stream.data_size - 1) && !ref_adsr_time_scale && !ref_wf_period && !ref_wf_amplitude && !ref_adsr_release_start) {
-		seq_buf_frame.adsr_time_scale_1 = 0;
+/* Sync point of the seek index: the state of the engine and of the reader at the start of a sample */
+struct seek_point_t {
+	uint32_t sample;
+	struct synth_ctx_t engine;
+	size_t bit_pos;
+	int frames_left;
+	int call_left;
+	size_t return_pos;
+	int frames_read;
+	/* Index of `cur_voice` in the voices, -1 if none: the index can be stored and loaded by another process */
+	int cur_voice_index;
+};
+
+/* Seek index of the stream compiled in the port reader */
+struct seek_index_t {
+	struct seek_point_t* points;
+	int count;
+};
+
+/* Frames from a sync point to the next one */
+#define SEEK_INTERVAL_FRAMES 64
+
+static void seek_point_save(SYNTH_CTX_PARAM_ struct seek_point_t* point, uint32_t sample) {
+	const struct stream_reader_t* reader = ctx->port;
+	point->sample = sample;
+	point->engine = *ctx;
+	point->bit_pos = reader->bit_pos;
+	point->frames_left = reader->frames_left;
+	point->call_left = reader->call_left;
+	point->return_pos = reader->return_pos;
+	point->frames_read = reader->frames_read;
+	point->cur_voice_index = cur_voice ? (int)(cur_voice - synth.voice) : -1;
+}
+
+/* 
+ * Play the stream compiled in the port reader once, and save a sync point every SEEK_INTERVAL_FRAMES frames,
+ * so `seek_stream` only plays the samples after the closest one. Free the index with `free(index->points)`.
+ */
+static int seek_index_build(SYNTH_CTX_PARAM_ struct seek_index_t* index, int voice_count) {
+	struct stream_reader_t* reader = ctx->port;
+	int capacity = reader->bit_stream.frame_count / SEEK_INTERVAL_FRAMES + 2;
+	index->points = malloc(sizeof(struct seek_point_t) * capacity);
+	if (!index->points) {
+		fprintf(stderr, "Out of memory building the seek index\n");
+		return 1;
+	}
+
+	memset(synth.voice, 0, sizeof(synth.voice));
+	start_stream(SYNTH_CTX_ARG_ voice_count);
+	seek_point_save(SYNTH_CTX_ARG_ &index->points[0], 0);
+	index->count = 1;
+	uint32_t sample = 0;
+	while (!seq_end) {
+		int frames_read = reader->frames_read;
+		seq_feed_synth(SYNTH_CTX_ARG);
+		sample++;
+		if (!seq_end && reader->frames_read / SEEK_INTERVAL_FRAMES != frames_read / SEEK_INTERVAL_FRAMES && index->count < capacity) {
+			seek_point_save(SYNTH_CTX_ARG_ &index->points[index->count++], sample);
+		}
+	}
+	return 0;
+}
+
+/* Change it when the engine or the reader state changes, to invalidate the stored seek indexes */
+#define SEEK_INDEX_VERSION 1
+
+/* FNV-1a */
+static uint64_t seek_hash(uint64_t hash, const void* data, size_t size) {
+	const uint8_t* bytes = data;
+	for (; size; size--, bytes++) {
+		hash = (hash ^ *bytes) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+/* Key of the seek index of the stream compiled in the port reader: the hash of the stream, of its ref tables and of the engine configuration */
+static uint64_t seek_index_key(SYNTH_CTX_PARAM_ int voice_count) {
+	const struct stream_reader_t* reader = ctx->port;
+	const struct bit_stream_t* bit_stream = &reader->bit_stream;
+	const uint32_t salt[] = { SEEK_INDEX_VERSION, SEEK_INTERVAL_FRAMES, synth_freq, sizeof(struct seek_point_t), voice_count, 
+		bit_stream->flags, bit_stream->frame_bits, bit_stream->frame_bytes, bit_stream->frame_count, bit_stream->pattern_ptr_bits, bit_stream->pattern_len_bits };
+	uint64_t hash = seek_hash(0xcbf29ce484222325ull, salt, sizeof(salt));
+	const struct ref_map_t* maps[] = { &bit_stream->refs_adsr_time_scale, &bit_stream->refs_wf_period, &bit_stream->refs_wf_amplitude, 
+		&bit_stream->refs_adsr_release_start, &bit_stream->refs_wf_period_delta };
+	for (size_t i = 0; i < sizeof(maps) / sizeof(maps[0]); i++) {
+		hash = seek_hash(hash, &maps[i]->count, sizeof(maps[i]->count));
+		hash = seek_hash(hash, maps[i]->values, sizeof(int) * maps[i]->count);
+		hash = seek_hash(hash, &maps[i]->bit_count, sizeof(maps[i]->bit_count));
+		hash = seek_hash(hash, maps[i]->code_counts, sizeof(maps[i]->code_counts));
+		hash = seek_hash(hash, &maps[i]->code_bits, sizeof(maps[i]->code_bits));
+	}
+	return seek_hash(hash, bit_stream->data, bit_stream->data_size);
+}
+
+/* Load a stored seek index: the sync point count, then the points. Returns non-zero if missing or invalid */
+static int seek_index_load(struct seek_index_t* index, const char* path) {
+	FILE* fp = fopen(path, "rb");
+	if (!fp) {
+		return 1;
+	}
+	uint32_t count;
+	int err = fread(&count, sizeof(count), 1, fp) != 1 || !count;
+	if (!err) {
+		index->count = count;
+		index->points = malloc(sizeof(struct seek_point_t) * count);
+		err = !index->points || fread(index->points, sizeof(struct seek_point_t), count, fp) != count || fgetc(fp) != EOF;
+		if (err) {
+			free(index->points);
+		}
+	}
+	fclose(fp);
+	return err;
+}
+
+/* Store a seek index, renamed in place when complete so a concurrent reader never sees a partial one */
+static void seek_index_store(const struct seek_index_t* index, const char* path) {
+	char tmp_path[1040];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+	int fd = mkstemp(tmp_path);
+	FILE* fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (!fp) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_path);
+		}
+		fprintf(stderr, "Cannot write the seek index %s\n", path);
+		return;
+	}
+	uint32_t count = index->count;
+	int err = fwrite(&count, sizeof(count), 1, fp) != 1;
+	err |= fwrite(index->points, sizeof(struct seek_point_t), count, fp) != count;
+	err |= fclose(fp) != 0;
+	if (err || rename(tmp_path, path)) {
+		unlink(tmp_path);
+		fprintf(stderr, "Cannot write the seek index %s\n", path);
+	}
+}
+
+/* 
+ * Load the seek index of the stream compiled in the port reader from the cache directory `dir`, named by `seek_index_key`.
+ * When missing, build it with `seek_index_build` and store it, so only the first seek in a tune plays the whole stream.
+ */
+static int seek_index_open(SYNTH_CTX_PARAM_ struct seek_index_t* index, int voice_count, const char* dir) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%016llx.seek", dir, (unsigned long long)seek_index_key(SYNTH_CTX_ARG_ voice_count));
+	if (!seek_index_load(index, path)) {
+		return 0;
+	}
+	if (seek_index_build(SYNTH_CTX_ARG_ index, voice_count)) {
+		return 1;
+	}
+	seek_index_store(index, path);
+	return 0;
+}
+
+/* Play the samples from `pos` up to `sample`. Returns the sample reached, less than `sample` at the end of the stream */
+static uint32_t seek_play(SYNTH_CTX_PARAM_ uint32_t pos, uint32_t sample) {
+	while (pos < sample && !seq_end) {
+		uint32_t left = sample - pos;
+		pos += seq_render_block(SYNTH_CTX_ARG_ samples, left < sizeof(samples) / sizeof(int16_t) ? left : sizeof(samples) / sizeof(int16_t));
+	}
+	return pos;
+}
+
+/* 
+ * Restore the closest sync point before `sample`, then play the samples up to it. Returns the sample reached,
+ * less than `sample` at the end of the stream.
+ */
+static uint32_t seek_stream(SYNTH_CTX_PARAM_ const struct seek_index_t* index, uint32_t sample) {
+	int lo = 0;
+	int hi = index->count - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (index->points[mid].sample <= sample) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	const struct seek_point_t* point = &index->points[lo];
+	struct stream_reader_t* reader = ctx->port;
+	*ctx = point->engine;
+	ctx->port = reader;
+	reader->bit_pos = point->bit_pos;
+	reader->frames_left = point->frames_left;
+	reader->call_left = point->call_left;
+	reader->return_pos = point->return_pos;
+	reader->frames_read = point->frames_read;
+	cur_voice = point->cur_voice_index >= 0 ? &synth.voice[point->cur_voice_index] : NULL;
+	return seek_play(SYNTH_CTX_ARG_ point->sample, sample);
+}
+
+/* 
+ * Render a MML file to a WAV (or raw PCM) file, or to stdout. No audio device is used, so it runs as fast as possible.
+ * With `rate`, the preview renderer is used, at that sample rate. The render starts at `start` seconds: through the seek index
+ * stored in the cache directory when set, else by playing the stream up to it.
+ */
+static int render_mml(SYNTH_CTX_PARAM_ const char* name, const char* out_path, int raw, int rate, double start) {
+	// Keep stdout clean when piping the samples
+	if (!strcmp(out_path, "-")) {
+		seq_verbose = 0;
+	}
+
+	int voice_count;
+	int channel_count;
+	int do_clip_check;
+	if (compile_mml(SYNTH_CTX_ARG_ name, &voice_count, &channel_count, &do_clip_check)) {
+		return 1;
+	}
+
+	struct wav_writer_t writer;
+	if (wav_open(&writer, out_path, rate ? rate : synth_freq, raw)) {
+		return 1;
+	}
+
+	int err = 0;
+	memset(synth.voice, 0, sizeof(synth.voice));
+	start_stream(SYNTH_CTX_ARG_ voice_count);
+	if (start > 0 && mml_cache_dir) {
+		struct seek_index_t index;
+		err = seek_index_open(SYNTH_CTX_ARG_ &index, voice_count, mml_cache_dir);
+		if (!err) {
+			seek_stream(SYNTH_CTX_ARG_ &index, (uint32_t)(start * synth_freq));
+			free(index.points);
+		}
+	} else if (start > 0) {
+		// A single seek: building the index would play the whole stream
+		seek_play(SYNTH_CTX_ARG_ 0, (uint32_t)(start * synth_freq));
+	}
+	if (rate && !err) {
+		err = render_hifi(SYNTH_CTX_ARG_ &writer, rate);
 	} else {
-		seq_buf_frame.adsr_time_scale_1 = bit_stream.refs_adsr_time_scale.values[ref_adsr_time_scale];
-		seq_buf_frame.wf_period = bit_stream.refs_wf_period.values[ref_wf_period];
-		seq_buf_frame.wf_amplitude = bit_stream.refs_wf_amplitude.values[ref_wf_amplitude];
-		seq_buf_frame.adsr_release_start = bit_stream.refs_adsr_release_start.values[ref_adsr_release_start];
+		while (!seq_end && !err) {
+			samples_sz = seq_render_block(SYNTH_CTX_ARG_ samples, sizeof(samples) / sizeof(int16_t));
+			err = wav_write(&writer, samples, samples_sz);
+		}
 	}
+	err |= wav_close(&writer);
+	if (err) {
+		fprintf(stderr, "Cannot write the %s file\n", out_path);
+	}
+#ifdef SEQ_STATS
+	err |= write_stats(SYNTH_CTX_ARG_ name, voice_count);
+#endif
+
+	struct stream_reader_t* reader = ctx->port;
+	stream_free(&reader->bit_stream);
+	return err;
 }
 
-int main(int argc, char** argv) {
-	int voice = 0;
+/* Tune of the `bench` golden file: the hash of the rendered samples */
+struct bench_golden_t {
+	char name[256];
+	uint64_t hash;
+};
+
+static double bench_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* FNV-1a of the 16-bit samples, little endian */
+static uint64_t bench_hash(uint64_t hash, const int16_t* buffer, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		uint16_t sample = buffer[i];
+		hash = (hash ^ (sample & 0xff)) * 0x100000001b3ull;
+		hash = (hash ^ (sample >> 8)) * 0x100000001b3ull;
+	}
+	return hash;
+}
+#define BENCH_HASH_INIT 0xcbf29ce484222325ull
+
+/* File name without the path, the key of the golden file */
+static const char* bench_base_name(const char* name) {
+	const char* base = strrchr(name, '/');
+	return base ? base + 1 : name;
+}
+
+/* 
+ * Compile and render a MML file `repeat` times, and print the throughputs. 
+ * The rendered samples are checked against the sample by sample playback and against the golden hash, when `golden` is set.
+ * Returns the hash in `hash`.
+ */
+static int bench_mml(SYNTH_CTX_PARAM_ const char* name, int repeat, const struct bench_golden_t* golden, uint64_t* hash) {
+	struct stream_reader_t* reader = ctx->port;
+	int err = 0;
+	double start = bench_now();
+	struct seq_frame_map_t map;
+	if (parse_mml(name, &map)) {
+		return 1;
+	}
+	double parse_time = bench_now() - start;
+
+	// The frame order of the sample by sample simulation, and of the fast one
+	struct seq_frame_t* frame_stream;
+	int frame_count;
+	int voice_count;
+	seq_compile(SYNTH_CTX_ARG_ &map, &frame_stream, &frame_count, &voice_count, SEQ_COMPILE_SAMPLES);
+	struct seq_frame_t* fast_stream = NULL;
+	start = bench_now();
+	for (int i = 0; i < repeat; i++) {
+		seq_free(fast_stream);
+		seq_compile(SYNTH_CTX_ARG_ &map, &fast_stream, &frame_count, &voice_count, SEQ_COMPILE_FAST);
+	}
+	double compile_time = (bench_now() - start) / repeat;
+	mml_free(&map);
+	if (memcmp(frame_stream, fast_stream, sizeof(struct seq_frame_t) * frame_count)) {
+		printf("%s: FAILED, the compiler modes differ\n", name);
+		err = 1;
+	}
+	seq_free(fast_stream);
+
+	start = bench_now();
+	for (int i = 0; i < repeat && !err; i++) {
+		if (i) {
+			stream_free(&reader->bit_stream);
+		}
+		err = stream_compress(frame_stream, frame_count, voice_count, &reader->bit_stream, stream_flags);
+	}
+	double compress_time = (bench_now() - start) / repeat;
+	seq_free(frame_stream);
+	if (err) {
+		return 1;
+	}
 
+	// Reference playback, one sample at a time as the PIC does
+	uint64_t sample_hash = BENCH_HASH_INIT;
+	size_t sample_count = 0;
 	memset(synth.voice, 0, sizeof(synth.voice));
+	start_stream(SYNTH_CTX_ARG_ voice_count);
+	while (!seq_end) {
+		// The last sample, of the voices before the end-of-stream fetch, is played too
+		int16_t sample = (int16_t)(seq_feed_synth(SYNTH_CTX_ARG) << 8);
+		sample_hash = bench_hash(sample_hash, &sample, 1);
+		sample_count++;
+	}
+	// The bit-packed streams end with two frames of zeros. The end test (the same of the PIC port) can only 
+	// tell the second one from a frame of all ref 0, so the first one may be played too
+	int flags = reader->bit_stream.flags;
+	int extra = !STREAM_COUNTED_END(flags) && !(flags & STREAM_BYTE_ALIGNED);
+	if (reader->frames_read < frame_count || reader->frames_read > frame_count + extra) {
+		printf("%s: FAILED, %d frames compiled, %d played\n", name, frame_count, reader->frames_read);
+		err = 1;
+	}
+
+#ifdef SEQ_STATS
+	struct seq_stats_t sample_stats = seq_stats;
+	struct seq_stats_t block_stats;
+#endif
+
+	// Block playback, the one timed
+	*hash = BENCH_HASH_INIT;
+	size_t rendered = 0;
+	start = bench_now();
+	for (int i = 0; i < repeat; i++) {
+		memset(synth.voice, 0, sizeof(synth.voice));
+		start_stream(SYNTH_CTX_ARG_ voice_count);
+		while (!seq_end) {
+			samples_sz = seq_render_block(SYNTH_CTX_ARG_ samples, sizeof(samples) / sizeof(int16_t));
+			if (!i) {
+				*hash = bench_hash(*hash, samples, samples_sz);
+				rendered += samples_sz;
+			}
+		}
+#ifdef SEQ_STATS
+		if (!i) {
+			block_stats = seq_stats;
+		}
+#endif
+	}
+	double render_time = (bench_now() - start) / repeat;
+	memset(synth.voice, 0, sizeof(synth.voice));
+	if (*hash != sample_hash || rendered != sample_count) {
+		printf("%s: FAILED, the block playback differs from the sample one\n", name);
+		err = 1;
+	}
+#ifdef SEQ_STATS
+	if (memcmp(&sample_stats, &block_stats, sizeof(struct seq_stats_t))) {
+		printf("%s: FAILED, the counters of the block playback differ from the sample one\n", name);
+		err = 1;
+	}
+#endif
 
+	const struct bit_stream_t* bit_stream = &reader->bit_stream;
+	printf("%s: %d voices, %d frames, %d bytes (%.2f bits per frame)\n", name, voice_count, frame_count, 
+		bit_stream->data_size, frame_count ? bit_stream->data_size * 8.0 / frame_count : 0);
+	printf("\tparse %.3f ms, seq_compile %.3f ms, stream_compress %.3f ms\n", parse_time * 1e3, compile_time * 1e3, compress_time * 1e3);
+	printf("\trender %zu samples in %.3f ms: %.1f Msamples/s, %.1f Msamples/s per voice\n", rendered, render_time * 1e3,
+		render_time > 0 ? rendered / render_time * 1e-6 : 0, render_time > 0 ? rendered * voice_count / render_time * 1e-6 : 0);
+	if (golden && golden->hash != *hash) {
+		printf("\thash %016llx: FAILED, expected %016llx\n", (unsigned long long)*hash, (unsigned long long)golden->hash);
+		err = 1;
+	} else {
+		printf("\thash %016llx: %s\n", (unsigned long long)*hash, golden ? "OK" : "no golden value");
+	}
+	stream_free(&reader->bit_stream);
+	return err;
+}
+
+/* 
+ * Benchmark all the files, and check the hashes of the samples against the `golden_path` file, 
+ * with a `HASH NAME` line per tune. With `update`, the file is rewritten with the current hashes.
+ * Returns the failed count.
+ */
+static int bench(SYNTH_CTX_PARAM_ const char* golden_path, int update, int repeat, int file_count, char** files) {
+	struct bench_golden_t* golden = NULL;
+	int golden_count = 0;
+	if (golden_path && !update) {
+		FILE* fp = fopen(golden_path, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot read the golden file %s\n", golden_path);
+			return 1;
+		}
+		char line[300];
+		while (fgets(line, sizeof(line), fp)) {
+			struct bench_golden_t entry;
+			unsigned long long hash;
+			if (line[0] == '#' || sscanf(line, "%llx %255s", &hash, entry.name) != 2) {
+				continue;
+			}
+			entry.hash = hash;
+			golden = realloc(golden, sizeof(struct bench_golden_t) * (golden_count + 1));
+			golden[golden_count++] = entry;
+		}
+		fclose(fp);
+	}
+
+	FILE* out = NULL;
+	if (update) {
+		out = fopen(golden_path, "w");
+		if (!out) {
+			fprintf(stderr, "Cannot write the golden file %s\n", golden_path);
+			return 1;
+		}
+		fprintf(out, "# Hash of the samples rendered by `synth bench`, see `make bench`\n");
+	}
+
+	int failed = 0;
+	seq_verbose = 0;
+	for (int i = 0; i < file_count; i++) {
+		const char* base = bench_base_name(files[i]);
+		const struct bench_golden_t* entry = NULL;
+		for (int j = 0; j < golden_count && !entry; j++) {
+			if (!strcmp(golden[j].name, base)) {
+				entry = &golden[j];
+			}
+		}
+		if (golden_path && !update && !entry) {
+			printf("%s: FAILED, not in the golden file\n", files[i]);
+		}
+		uint64_t hash;
+		int err = bench_mml(SYNTH_CTX_ARG_ files[i], repeat, entry, &hash) || (golden_path && !update && !entry);
+		if (out && !err) {
+			fprintf(out, "%016llx %s\n", (unsigned long long)hash, base);
+		}
+		failed += err;
+	}
+	seq_verbose = 1;
+	printf("%d tunes, %d failed\n", file_count, failed);
+
+	if (out) {
+		fclose(out);
+	}
+	free(golden);
+	return failed;
+}
+
+/* Output of `compile-mml`: the out.wav file, and the live audio when available. Opened at the first use */
+#ifndef NO_AO
+static ao_device* wav_device;
+static ao_device* live_device;
+#else
+static struct wav_writer_t wav_file;
+#endif
+static int output_opened;
+
+static int output_open() {
+	if (output_opened) {
+		return 0;
+	}
+#ifndef NO_AO
 	ao_sample_format format;
 	memset(&format, 0, sizeof(format));
 	format.bits = 16;
@@ -127,25 +1310,342 @@ int main(int argc, char** argv) {
 
 	ao_initialize();
 	int wav_driver = ao_driver_id("wav");
-	ao_device* wav_device = ao_open_file(
+	wav_device = ao_open_file(
 		wav_driver, "out.wav", 1, &format, NULL
 	);
 
 	if (!wav_device) {
 		fprintf(stderr, "Failed to open WAV device\n");
+		ao_shutdown();
 		return 1;
 	}
 
-	ao_device* live_device = NULL;
 	int live_driver = ao_default_driver_id();
 	live_device = ao_open_live(live_driver, &format, NULL);
 	if (!live_device) {
 		printf("Live driver not available\n");
 	}
+#else
+	if (wav_open(&wav_file, "out.wav", synth_freq, 0)) {
+		return 1;
+	}
+#endif
+	output_opened = 1;
+	return 0;
+}
+
+static void output_play(int16_t* buffer, size_t count) {
+#ifndef NO_AO
+	ao_play(wav_device, (char*)buffer, 2*count);
+
+	if (live_device) {
+		ao_play(
+			live_device,
+			(char*)buffer, 2*count
+		);
+	}
+#else
+	wav_write(&wav_file, buffer, count);
+#endif
+}
+
+/* Whether `output_play` waits for the audio device, so it follows the real time */
+static int output_realtime() {
+#ifndef NO_AO
+	return live_device != NULL;
+#else
+	return 0;
+#endif
+}
+
+/* Play the notes of a live input, see `live_run` */
+static int play_live(SYNTH_CTX_PARAM_ const char* midi_path, struct live_config_t* config) {
+	config->input = stdin;
+	config->input_type = LIVE_INPUT_TEXT;
+	if (midi_path) {
+		config->input = fopen(midi_path, "rb");
+		config->input_type = LIVE_INPUT_MIDI;
+		if (!config->input) {
+			fprintf(stderr, "Cannot open the MIDI input %s\n", midi_path);
+			return 1;
+		}
+	}
+	if (output_open()) {
+		return 1;
+	}
+	config->play = output_play;
+	config->paced = !output_realtime();
+	int err = live_run(SYNTH_CTX_ARG_ config);
+	if (midi_path) {
+		fclose(config->input);
+	}
+	return err;
+}
+
+/* Sinks of the `compile-mml` pipeline */
+static void write_wav(void* user, const int16_t* buffer, size_t count) {
+	(void)user;
+#ifndef NO_AO
+	ao_play(wav_device, (char*)buffer, 2*count);
+#else
+	wav_write(&wav_file, buffer, count);
+#endif
+}
+
+#ifndef NO_AO
+static void write_live(void* user, const int16_t* buffer, size_t count) {
+	(void)user;
+	ao_play(live_device, (char*)buffer, 2*count);
+}
+#endif
+
+static size_t render_stream(void* user, int16_t* out, size_t count) {
+	struct synth_ctx_t* ctx = user;
+	return seq_render_block(SYNTH_CTX_ARG_ out, count);
+}
+
+/* 
+ * Play the stream to the out.wav file and to the live device, each one in its own thread.
+ * The blocks of 256 samples are 26 ms long, and the ring of 8 blocks keeps the output latency at 0.2 s.
+ */
+static int output_stream(SYNTH_CTX_PARAM) {
+	struct pipeline_sink_t sinks[2];
+	int sink_count = 0;
+	sinks[sink_count].write = write_wav;
+	sinks[sink_count++].user = NULL;
+#ifndef NO_AO
+	if (live_device) {
+		sinks[sink_count].write = write_live;
+		sinks[sink_count++].user = NULL;
+	}
+#endif
+	if (pipeline_run(render_stream, ctx, sinks, sink_count, 256, 8)) {
+		return 1;
+	}
+	if (sink_count > 1 && seq_verbose) {
+		printf("Playback stats:\n\t%d underruns on the live device\n", sinks[1].underruns);
+	}
+	return 0;
+}
+
+static void output_close() {
+	if (!output_opened) {
+		return;
+	}
+#ifndef NO_AO
+	ao_close(wav_device);
+	if (live_device) {
+		ao_close(live_device);
+	}
+	ao_shutdown();
+#else
+	wav_close(&wav_file);
+#endif
+	output_opened = 0;
+}
+
+int main(int argc, char** argv) {
+	struct synth_ctx_t* ctx = &engine;
+	ctx->port = &reader;
+
+	seq_render_set_kernel(render_simd_select(NULL));
+	mml_set_error_handler(mml_error);
 
 	argc--;
 	argv++;
 	while (argc > 0) {
+		/* Force a render kernel, e.g. to compare it with the scalar one */
+		if (!strcmp(argv[0], "--kernel")) {
+			const struct seq_render_kernel_t* kernel = render_simd_select(argv[1]);
+			printf("Render kernel: %s\n", render_simd_name(kernel));
+			seq_render_set_kernel(kernel);
+			argv += 2;
+			argc -= 2;
+			continue;
+		}
+		/* Compile the streams with byte-aligned frames, see STREAM_BYTE_ALIGNED */
+		if (!strcmp(argv[0], "--byte-aligned")) {
+			stream_flags |= STREAM_BYTE_ALIGNED;
+			argv++;
+			argc--;
+			continue;
+		}
+		/* Compile the streams with Huffman codes, see STREAM_HUFFMAN */
+		if (!strcmp(argv[0], "--huffman")) {
+			stream_flags |= STREAM_HUFFMAN;
+			argv++;
+			argc--;
+			continue;
+		}
+		/* Write the playback counters of `compile-mml` and `render` to a JSON file, see SEQ_STATS */
+		if (!strcmp(argv[0], "--stats") && argc >= 2) {
+#ifdef SEQ_STATS
+			stats_path = argv[1];
+			argv += 2;
+			argc -= 2;
+			continue;
+#else
+			fprintf(stderr, "The --stats option requires the STATS=1 build\n");
+			return 1;
+#endif
+		}
+		/* Keep the frames of the parsed channels in a directory, and parse only the edited ones, see `mml_cache_open` */
+		if (!strcmp(argv[0], "--cache") && argc >= 2) {
+			mml_cache_dir = argv[1];
+			argv += 2;
+			argc -= 2;
+			continue;
+		}
+		/* Keep the amplitudes of the tunes that clip, and the clip check, instead of `seq_gain_stage` */
+		if (!strcmp(argv[0], "--clip")) {
+			gain_staging = 0;
+			argv++;
+			argc--;
+			continue;
+		}
+		/* Replace the repeated runs of frames with calls, see STREAM_PATTERNS */
+		if (!strcmp(argv[0], "--patterns")) {
+			stream_flags |= STREAM_PATTERNS;
+			argv++;
+			argc--;
+			continue;
+		}
+		/* Check the compiler modes against each other, on all the files passed */
+		if (!strcmp(argv[0], "check-compile")) {
+			int err = 0;
+			for (argc--, argv++; argc > 0; argc--, argv++) {
+				err |= check_compile(SYNTH_CTX_ARG_ argv[0]);
+			}
+			return err;
+		}
+		/* Compile many files in parallel, each one in its own output folder */
+		if (!strcmp(argv[0], "compile-batch")) {
+			int thread_count = pool_cpu_count();
+			int preview_rate = 0;
+			for (argc--, argv++; argc >= 2 && argv[0][0] == '-'; argc -= 2, argv += 2) {
+				if (!strcmp(argv[0], "-j")) {
+					thread_count = atoi(argv[1]);
+				} else if (!strcmp(argv[0], "--preview")) {
+					preview_rate = atoi(argv[1]);
+				} else {
+					break;
+				}
+			}
+			if (argc < 1 || preview_rate < 0) {
+				fprintf(stderr, "Usage: compile-batch [-j THREADS] [--preview HZ] OUT_DIR FILE.mml...\n");
+				return 1;
+			}
+			return compile_batch(argv[0], thread_count, preview_rate, argc - 1, argv + 1) != 0;
+		}
+		/* Compile the files in a single pack of tunes, see `compile_pack` */
+		if (!strcmp(argv[0], "compile-pack")) {
+			return compile_pack(SYNTH_CTX_ARG_ argc - 1, argv + 1) != 0;
+		}
+		/* Compile and render the files, with the throughputs and the check of the rendered samples */
+		if (!strcmp(argv[0], "bench")) {
+			const char* golden_path = NULL;
+			int update = 0;
+			int repeat = 10;
+			for (argc--, argv++; argc >= 1 && argv[0][0] == '-'; argc--, argv++) {
+				if (argc >= 2 && !strcmp(argv[0], "--golden")) {
+					golden_path = argv[1];
+					argc--;
+					argv++;
+				} else if (argc >= 2 && !strcmp(argv[0], "--update")) {
+					golden_path = argv[1];
+					update = 1;
+					argc--;
+					argv++;
+				} else if (argc >= 2 && !strcmp(argv[0], "--repeat")) {
+					repeat = atoi(argv[1]);
+					argc--;
+					argv++;
+				} else {
+					break;
+				}
+			}
+			if (argc < 1 || repeat < 1) {
+				fprintf(stderr, "Usage: bench [--golden FILE | --update FILE] [--repeat N] FILE.mml...\n");
+				return 1;
+			}
+			return bench(SYNTH_CTX_ARG_ golden_path, update, repeat, argc, argv) != 0;
+		}
+		/* Offline render to file, no audio devices */
+		if (!strcmp(argv[0], "render")) {
+			int raw = 0;
+			int rate = 0;
+			double start = 0;
+			for (argc--, argv++; argc >= 1 && argv[0][0] == '-' && argv[0][1]; argc--, argv++) {
+				if (!strcmp(argv[0], "--raw")) {
+					raw = 1;
+				} else if (argc >= 2 && !strcmp(argv[0], "--rate")) {
+					rate = atoi(argv[1]);
+					argc--;
+					argv++;
+				} else if (argc >= 2 && !strcmp(argv[0], "--start")) {
+					start = atof(argv[1]);
+					argc--;
+					argv++;
+				} else {
+					break;
+				}
+			}
+			if (argc < 2 || rate < 0 || start < 0) {
+				fprintf(stderr, "Usage: render [--raw] [--rate HZ] [--start SECONDS] FILE.mml OUT.wav|-\n");
+				return 1;
+			}
+			if (render_mml(SYNTH_CTX_ARG_ argv[0], argv[1], raw, rate, start)) {
+				return 1;
+			}
+			argc -= 2;
+			argv += 2;
+			continue;
+		}
+		/* Cycles per sample of the PIC port, with the PROFILE=1 build */
+		if (!strcmp(argv[0], "profile")) {
+#ifdef PROFILE_CYCLES
+			int err = 0;
+			for (argc--, argv++; argc > 0; argc--, argv++) {
+				err |= profile_mml(SYNTH_CTX_ARG_ argv[0]);
+			}
+			return err;
+#else
+			fprintf(stderr, "The profile command requires the PROFILE=1 build\n");
+			return 1;
+#endif
+		}
+		/* Play the notes from stdin or a MIDI device */
+		if (!strcmp(argv[0], "live")) {
+			struct live_config_t config;
+			memset(&config, 0, sizeof(config));
+			int block_size = 32;
+			int voice_count = VOICE_COUNT;
+			config.note_ms = 500;
+			const char* midi_path = NULL;
+			for (argc--, argv++; argc >= 2 && argv[0][0] == '-'; argc -= 2, argv += 2) {
+				if (!strcmp(argv[0], "--midi")) {
+					midi_path = argv[1];
+				} else if (!strcmp(argv[0], "--block")) {
+					block_size = atoi(argv[1]);
+				} else if (!strcmp(argv[0], "--voices")) {
+					voice_count = atoi(argv[1]);
+				} else if (!strcmp(argv[0], "--length")) {
+					config.note_ms = atoi(argv[1]);
+				} else {
+					break;
+				}
+			}
+			config.block_size = block_size;
+			config.voice_count = voice_count;
+			if (block_size < 1 || voice_count < 1 || voice_count > VOICE_COUNT || config.note_ms < 1) {
+				fprintf(stderr, "Usage: live [--midi DEVICE] [--block SAMPLES] [--voices 1-%d] [--length MS]\n", VOICE_COUNT);
+				return 1;
+			}
+			if (play_live(SYNTH_CTX_ARG_ midi_path, &config)) {
+				return 1;
+			}
+			continue;
+		}
 		/* Check for MML compilation only */
 		if (!strcmp(argv[0], "compile-mml")) {
 			const char* name = argv[1];
@@ -153,47 +1653,23 @@ int main(int argc, char** argv) {
 			argc--;
 			
 			int voice_count;
-			if (process_mml(name, &voice_count)) {
+			if (process_mml(SYNTH_CTX_ARG_ name, NULL, &voice_count) || output_open()) {
 				return 1;
 			}
-
-			stream_pos = 0;
-			stream_pos_bit = 0;
-
-			seq_play_stream(voice_count);
-		}
-		argv++;
-		argc--;
-
-		/* Play out any remaining samples */
-		while (!seq_end) {
-			int16_t* sample_ptr = samples;
-			uint16_t samples_remain = sizeof(samples) / sizeof(uint16_t);
-
-			/* Fill the buffer as much as we can */
-			while (!seq_end && samples_remain) {
-				int16_t s = seq_feed_synth();
-				*sample_ptr = s << 8;
-				sample_ptr++;
-				samples_sz++;
-				samples_remain--;
+			start_stream(SYNTH_CTX_ARG_ voice_count);
+			if (output_stream(SYNTH_CTX_ARG)) {
+				return 1;
 			}
-			ao_play(wav_device, (char*)samples, 2*samples_sz);
-
-			if (live_device) {
-				ao_play(
-					live_device,
-					(char*)samples, 2*samples_sz
-				);
+#ifdef SEQ_STATS
+			if (write_stats(SYNTH_CTX_ARG_ name, voice_count)) {
+				return 1;
 			}
-			samples_sz = 0;
+#endif
 		}
+		argv++;
+		argc--;
 	}
 
-	ao_close(wav_device);
-	if (live_device) {
-		ao_close(live_device);
-	}
-	ao_shutdown();
+	output_close();
 	return 0;
 }
@@ -0,0 +1,202 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, MML parse cache.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include "mml_cache.h"
+#include "mml.h"
+#include "synth.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*! Change it when the parser output changes, to invalidate the old entries */
+#define MML_CACHE_VERSION 1
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static uint64_t fnv_hash(uint64_t hash, const void* data, size_t size) {
+	const uint8_t* bytes = data;
+	for (; size; size--, bytes++) {
+		hash = (hash ^ *bytes) * FNV_PRIME;
+	}
+	return hash;
+}
+
+/*! Lines with no commands (blank or comment only) don't change the channel frames */
+static int is_empty_line(const char* line, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		if (line[i] == '#' || line[i] == ';') {
+			return 1;
+		}
+		if (line[i] > 32 && line[i] != '|') {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void entry_path(char* path, size_t size, const char* dir, uint64_t key) {
+	snprintf(path, size, "%s/%016llx.frames", dir, (unsigned long long)key);
+}
+
+/*! Load an entry: the frame count, then the frames. Returns non-zero if missing or invalid */
+static int load_entry(const char* dir, uint64_t key, struct seq_frame_list_t* list) {
+	char path[1024];
+	entry_path(path, sizeof(path), dir, key);
+	FILE* fp = fopen(path, "rb");
+	if (!fp) {
+		return 1;
+	}
+	uint32_t count;
+	int err = fread(&count, sizeof(count), 1, fp) != 1;
+	if (!err) {
+		list->count = count;
+		list->frames = malloc(sizeof(struct seq_frame_t) * (count ? count : 1));
+		err = !list->frames || fread(list->frames, sizeof(struct seq_frame_t), count, fp) != count || fgetc(fp) != EOF;
+		if (err) {
+			free(list->frames);
+		}
+	}
+	fclose(fp);
+	return err;
+}
+
+/*! Store an entry, renamed in place when complete so a concurrent reader never sees a partial one */
+static void store_entry(const char* dir, uint64_t key, const struct seq_frame_list_t* list) {
+	char path[1024];
+	char tmp_path[1040];
+	entry_path(path, sizeof(path), dir, key);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+	int fd = mkstemp(tmp_path);
+	FILE* fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (!fp) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_path);
+		}
+		fprintf(stderr, "Cannot write the MML cache entry %s\n", path);
+		return;
+	}
+	uint32_t count = list->count;
+	int err = fwrite(&count, sizeof(count), 1, fp) != 1;
+	err |= fwrite(list->frames, sizeof(struct seq_frame_t), count, fp) != count;
+	err |= fclose(fp) != 0;
+	if (err || rename(tmp_path, path)) {
+		unlink(tmp_path);
+		fprintf(stderr, "Cannot write the MML cache entry %s\n", path);
+	}
+}
+
+int mml_cache_open(struct mml_cache_t* cache, const char* dir, FILE* fp) {
+	cache->dir = dir;
+	cache->used = 0;
+	cache->cached = 0;
+	if (mkdir(dir, 0777) && errno != EEXIST) {
+		fprintf(stderr, "Cannot create the MML cache directory %s\n", dir);
+	}
+
+	// The parser output also depends on the engine configuration
+	const uint32_t salt[] = { MML_CACHE_VERSION, synth_freq, ADSR_TIME_UNITS, sizeof(struct seq_frame_t) };
+	uint64_t seed = fnv_hash(FNV_OFFSET, salt, sizeof(salt));
+	for (int i = 0; i < MML_CACHE_CHANNELS; i++) {
+		cache->keys[i] = seed;
+	}
+
+	char* line = NULL;
+	size_t capacity = 0;
+	ssize_t size;
+	while ((size = getline(&line, &capacity, fp)) >= 0) {
+		if (size && line[size - 1] == '\n') {
+			size--;
+		}
+		if (is_empty_line(line, size)) {
+			continue;
+		}
+		uint32_t channels = mml_line_channels(line, size);
+		cache->used |= channels;
+		for (int i = 0; i < MML_CACHE_CHANNELS; i++) {
+			if (channels & (1u << i)) {
+				// Terminated, so the line split is part of the key
+				cache->keys[i] = fnv_hash(fnv_hash(cache->keys[i], line, size), "\n", 1);
+			}
+		}
+	}
+	free(line);
+	if (ferror(fp) || fseek(fp, 0, SEEK_SET)) {
+		return 1;
+	}
+
+	for (int i = 0; i < MML_CACHE_CHANNELS; i++) {
+		if ((cache->used & (1u << i)) && !load_entry(dir, cache->keys[i], &cache->lists[i])) {
+			cache->cached |= 1u << i;
+		}
+	}
+	return 0;
+}
+
+void mml_cache_close(struct mml_cache_t* cache, struct seq_frame_map_t* map) {
+	if (!map) {
+		for (int i = 0; i < MML_CACHE_CHANNELS; i++) {
+			if (cache->cached & (1u << i)) {
+				free(cache->lists[i].frames);
+			}
+		}
+		return;
+	}
+
+	// The parser map ends with the last channel with frames, the cached channels can be after it
+	int channel_count = map->channel_count;
+	for (int i = 0; i < MML_CACHE_CHANNELS; i++) {
+		if ((cache->cached & (1u << i)) && cache->lists[i].count && i >= channel_count) {
+			channel_count = i + 1;
+		}
+	}
+	if (channel_count > map->channel_count) {
+		map->channels = realloc(map->channels, sizeof(struct seq_frame_list_t) * channel_count);
+		for (int i = map->channel_count; i < channel_count; i++) {
+			map->channels[i].count = 0;
+			map->channels[i].frames = NULL;
+		}
+		map->channel_count = channel_count;
+	}
+
+	int reused = 0;
+	for (int i = 0; i < MML_CACHE_CHANNELS; i++) {
+		uint32_t bit = 1u << i;
+		if (cache->cached & bit) {
+			if (i < map->channel_count) {
+				free(map->channels[i].frames);
+				map->channels[i] = cache->lists[i];
+			} else {
+				free(cache->lists[i].frames);
+			}
+			reused++;
+		} else if (cache->used & bit) {
+			static const struct seq_frame_list_t empty = { 0, NULL };
+			store_entry(cache->dir, cache->keys[i], i < map->channel_count ? &map->channels[i] : &empty);
+		}
+	}
+
+	if (seq_verbose) {
+		printf("MML cache: %d of %d channels reused\n", reused, __builtin_popcount(cache->used));
+	}
+}
@@ -0,0 +1,61 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, MML parse cache.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#ifndef _MML_CACHE_H
+#define _MML_CACHE_H
+
+#include "sequencer.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*! Channels addressable by the MML selectors, A to Z */
+#define MML_CACHE_CHANNELS 26
+
+/*!
+ * On-disk cache of the parsed frame lists, one file per channel, named by the hash of the lines of the channel.
+ * As every channel state (tempo, octave, length...) is only changed by the lines of the channel, 
+ * an unchanged channel text gives the same frames, and only the edited channels are parsed again.
+ */
+struct mml_cache_t {
+	/*! Cache directory */
+	const char* dir;
+	/*! Key of every channel */
+	uint64_t keys[MML_CACHE_CHANNELS];
+	/*! Channels with at least a line, and channels loaded from the cache */
+	uint32_t used;
+	uint32_t cached;
+	/*! Loaded frame lists of the cached channels */
+	struct seq_frame_list_t lists[MML_CACHE_CHANNELS];
+};
+
+/*!
+ * Hash the lines of the MML file by channel, and load the cached frames. The file is rewound for the parser.
+ * The channels loaded are in `cache->cached`, to be passed to `mml_skip_channels`.
+ * Returns non-zero if the file cannot be read.
+ */
+int mml_cache_open(struct mml_cache_t* cache, const char* dir, FILE* fp);
+
+/*!
+ * Complete the map of the parsed channels with the cached ones, and store the parsed channels in the cache.
+ * With `map` NULL (e.g. parse error), only free the loaded frames.
+ */
+void mml_cache_close(struct mml_cache_t* cache, struct seq_frame_map_t* map);
+
+#endif
@@ -0,0 +1,165 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, audio pipeline.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include "pipeline.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*! Ring of rendered blocks. The blocks are numbered from the start, the block `i` is in the slot `i % block_count` */
+struct pipeline_t {
+	pthread_mutex_t lock;
+	/*! Signaled when a block is rendered, or a sink frees a slot */
+	pthread_cond_t changed;
+	int16_t* samples;
+	size_t* sizes;
+	size_t block_size;
+	int block_count;
+	/*! Blocks rendered so far */
+	long rendered;
+	/*! Set after the last block */
+	int end;
+	/*! Set when the ring was full the first time, or at the end: the underruns are counted from then */
+	int started;
+	struct pipeline_sink_t* sinks;
+	int sink_count;
+	/*! Blocks written so far, per sink */
+	long* written;
+};
+
+struct pipeline_worker_t {
+	struct pipeline_t* pipeline;
+	int index;
+};
+
+static void* sink_thread(void* arg) {
+	struct pipeline_worker_t* worker = arg;
+	struct pipeline_t* pipeline = worker->pipeline;
+	struct pipeline_sink_t* sink = &pipeline->sinks[worker->index];
+	long* written = &pipeline->written[worker->index];
+
+	pthread_mutex_lock(&pipeline->lock);
+	while (1) {
+		if (*written == pipeline->rendered) {
+			if (pipeline->end) {
+				break;
+			}
+			if (pipeline->started) {
+				sink->underruns++;
+			}
+			while (*written == pipeline->rendered && !pipeline->end) {
+				pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+			}
+			continue;
+		}
+
+		// The slot can't be overwritten before this sink is done with it
+		int slot = *written % pipeline->block_count;
+		pthread_mutex_unlock(&pipeline->lock);
+		sink->write(sink->user, pipeline->samples + slot * pipeline->block_size, pipeline->sizes[slot]);
+		pthread_mutex_lock(&pipeline->lock);
+		(*written)++;
+		pthread_cond_broadcast(&pipeline->changed);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return NULL;
+}
+
+/*! Blocks written by the slowest sink */
+static long slowest_written(const struct pipeline_t* pipeline) {
+	long min = pipeline->rendered;
+	for (int i = 0; i < pipeline->sink_count; i++) {
+		if (pipeline->written[i] < min) {
+			min = pipeline->written[i];
+		}
+	}
+	return min;
+}
+
+int pipeline_run(size_t (*render)(void* user, int16_t* out, size_t count), void* render_user, 
+		struct pipeline_sink_t* sinks, int sink_count, size_t block_size, int block_count) {
+	struct pipeline_t pipeline;
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.changed, NULL);
+	pipeline.samples = malloc(sizeof(int16_t) * block_size * block_count);
+	pipeline.sizes = malloc(sizeof(size_t) * block_count);
+	pipeline.block_size = block_size;
+	pipeline.block_count = block_count;
+	pipeline.rendered = 0;
+	pipeline.end = 0;
+	pipeline.started = 0;
+	pipeline.sinks = sinks;
+	pipeline.sink_count = sink_count;
+	pipeline.written = calloc(sink_count ? sink_count : 1, sizeof(long));
+	struct pipeline_worker_t* workers = malloc(sizeof(struct pipeline_worker_t) * (sink_count ? sink_count : 1));
+	pthread_t* threads = malloc(sizeof(pthread_t) * (sink_count ? sink_count : 1));
+
+	int err = !pipeline.samples || !pipeline.sizes || !pipeline.written || !workers || !threads;
+	int started_count = 0;
+	for (; !err && started_count < sink_count; started_count++) {
+		sinks[started_count].underruns = 0;
+		workers[started_count].pipeline = &pipeline;
+		workers[started_count].index = started_count;
+		if (pthread_create(&threads[started_count], NULL, sink_thread, &workers[started_count])) {
+			fprintf(stderr, "Cannot start the output threads\n");
+			err = 1;
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&pipeline.lock);
+	while (!err) {
+		// Wait for a free slot
+		while (pipeline.rendered - slowest_written(&pipeline) == block_count) {
+			pipeline.started = 1;
+			pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+		}
+
+		// Render out of the lock, the slot is not in use by the sinks
+		int slot = pipeline.rendered % block_count;
+		pthread_mutex_unlock(&pipeline.lock);
+		size_t count = render(render_user, pipeline.samples + slot * block_size, block_size);
+		pthread_mutex_lock(&pipeline.lock);
+
+		if (count) {
+			pipeline.sizes[slot] = count;
+			pipeline.rendered++;
+		}
+		if (count < block_size) {
+			break;
+		}
+		pthread_cond_broadcast(&pipeline.changed);
+	}
+	pipeline.end = 1;
+	pthread_cond_broadcast(&pipeline.changed);
+	pthread_mutex_unlock(&pipeline.lock);
+
+	for (int i = 0; i < started_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	free(workers);
+	free(pipeline.written);
+	free(pipeline.sizes);
+	free(pipeline.samples);
+	pthread_cond_destroy(&pipeline.changed);
+	pthread_mutex_destroy(&pipeline.lock);
+	return err;
+}
@@ -0,0 +1,44 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, audio pipeline.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*! Output of the pipeline, written by its own thread */
+struct pipeline_sink_t {
+	/*! Write the samples, can block (e.g. an audio device) */
+	void (*write)(void* user, const int16_t* samples, size_t count);
+	void* user;
+	/*! Set by `pipeline_run`: times the sink waited for a block not rendered yet, after the ring was first filled */
+	int underruns;
+};
+
+/*!
+ * Render with `render` a block of `block_size` samples at a time in a ring of `block_count` blocks, 
+ * while every sink writes the rendered blocks by its own: a slow sink doesn't hold the others back
+ * until the ring is full. `render` returns less than `block_size` samples at the end.
+ * Returns non-zero if the threads cannot be created or out of memory.
+ */
+int pipeline_run(size_t (*render)(void* user, int16_t* out, size_t count), void* render_user, 
+		struct pipeline_sink_t* sinks, int sink_count, size_t block_size, int block_count);
+
+#endif
@@ -34,6 +34,14 @@
 #define VOICE_COUNT 8
 
 #define CHECK_CLIPPING
+
+/*! Decode the STREAM_PERIOD_DELTA streams, with the last period ref in the voices */
+#define SEQ_PERIOD_DELTA
+
+/*! Use engine instances instead of globals, see `struct synth_ctx_t` */
+#define SYNTH_REENTRANT
+#ifndef SYNTH_REENTRANT
 extern int clip_count;
+#endif
 
 #endif
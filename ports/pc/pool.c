@@ -0,0 +1,129 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, worker pool.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include "pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*! Range of task indexes owned by a worker. The owner pops from the front, thieves from the back */
+struct pool_queue_t {
+	pthread_mutex_t lock;
+	int begin;
+	int end;
+};
+
+struct pool_t {
+	int thread_count;
+	struct pool_queue_t* queues;
+	void (*task)(int i, void* user);
+	void* user;
+};
+
+struct pool_worker_t {
+	struct pool_t* pool;
+	int index;
+};
+
+/*! Take the next task of a queue, from the front or from the back. Returns -1 if empty */
+static int queue_take(struct pool_queue_t* queue, int steal) {
+	int i = -1;
+	pthread_mutex_lock(&queue->lock);
+	if (queue->begin < queue->end) {
+		i = steal ? --queue->end : queue->begin++;
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return i;
+}
+
+static void* pool_worker(void* arg) {
+	struct pool_worker_t* worker = arg;
+	struct pool_t* pool = worker->pool;
+	
+	while (1) {
+		int i = queue_take(&pool->queues[worker->index], 0);
+		// Own queue empty: steal from the others.
+		// Tasks are never added, so when all queues are found empty the work is over
+		for (int j = 1; i < 0 && j < pool->thread_count; j++) {
+			i = queue_take(&pool->queues[(worker->index + j) % pool->thread_count], 1);
+		}
+		if (i < 0) {
+			break;
+		}
+		pool->task(i, pool->user);
+	}
+	return NULL;
+}
+
+void pool_run(int thread_count, int task_count, void (*task)(int i, void* user), void* user) {
+	if (thread_count > task_count) {
+		thread_count = task_count;
+	}
+	if (thread_count <= 1) {
+		for (int i = 0; i < task_count; i++) {
+			task(i, user);
+		}
+		return;
+	}
+
+	struct pool_t pool;
+	pool.thread_count = thread_count;
+	pool.task = task;
+	pool.user = user;
+	pool.queues = malloc(sizeof(struct pool_queue_t) * thread_count);
+	struct pool_worker_t* workers = malloc(sizeof(struct pool_worker_t) * thread_count);
+	pthread_t* threads = malloc(sizeof(pthread_t) * thread_count);
+
+	for (int i = 0; i < thread_count; i++) {
+		pthread_mutex_init(&pool.queues[i].lock, NULL);
+		pool.queues[i].begin = (int)((long)task_count * i / thread_count);
+		pool.queues[i].end = (int)((long)task_count * (i + 1) / thread_count);
+		workers[i].pool = &pool;
+		workers[i].index = i;
+	}
+
+	int started = 0;
+	for (; started < thread_count; started++) {
+		if (pthread_create(&threads[started], NULL, pool_worker, &workers[started])) {
+			fprintf(stderr, "Cannot create the worker threads, %d started\n", started);
+			break;
+		}
+	}
+	// The queues of the workers not started are stolen by the others, or drained here
+	if (!started) {
+		pool_worker(&workers[0]);
+	}
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (int i = 0; i < thread_count; i++) {
+		pthread_mutex_destroy(&pool.queues[i].lock);
+	}
+	free(threads);
+	free(workers);
+	free(pool.queues);
+}
+
+int pool_cpu_count() {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+}
@@ -0,0 +1,34 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, worker pool.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+#ifndef _POOL_H
+#define _POOL_H
+
+/*!
+ * Run `task(i, user)` for every `i` in [0, task_count) on `thread_count` worker threads, and wait for all of them.
+ * The tasks are split evenly between the workers, and an idle worker steals the tasks
+ * left by the others, so long tasks don't keep the other workers waiting.
+ * If the threads cannot be created, the tasks are run by the calling thread.
+ */
+void pool_run(int thread_count, int task_count, void (*task)(int i, void* user), void* user);
+
+/*! Number of online CPUs, at least 1 */
+int pool_cpu_count();
+
+#endif
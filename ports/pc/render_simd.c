@@ -0,0 +1,177 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, SIMD render kernels.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include "render_simd.h"
+#include "synth.h"
+#include <string.h>
+
+/*!
+ * Kernels for `seq_render_block`. The voices are rendered in runs of constant
+ * value (see `voice_render`), so the kernels are vectorized along the run samples.
+ * The results are the same of the scalar kernel.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void mix_sse2(int16_t* acc, int16_t value, size_t count) {
+	const __m128i v = _mm_set1_epi16(value);
+	for (; count >= 8; count -= 8, acc += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*)acc);
+		_mm_storeu_si128((__m128i*)acc, _mm_add_epi16(a, v));
+	}
+	for (; count; count--, acc++) {
+		*acc += value;
+	}
+}
+
+__attribute__((target("sse2")))
+static size_t output_sse2(int16_t* acc, size_t count) {
+	size_t clipped = 0;
+#ifndef NO_CLIP_CHECK
+	const __m128i max = _mm_set1_epi16(INT8_MAX);
+	const __m128i min = _mm_set1_epi16(INT8_MIN);
+#endif
+	for (; count >= 8; count -= 8, acc += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*)acc);
+#ifndef NO_CLIP_CHECK
+		__m128i out = _mm_or_si128(_mm_cmpgt_epi16(a, max), _mm_cmplt_epi16(a, min));
+		// Two mask bits per 16-bit lane
+		clipped += __builtin_popcount(_mm_movemask_epi8(out)) / 2;
+		a = _mm_min_epi16(_mm_max_epi16(a, min), max);
+#endif
+		// (int8_t)x << 8 is x << 8 truncated to 16 bits
+		_mm_storeu_si128((__m128i*)acc, _mm_slli_epi16(a, 8));
+	}
+	return clipped + seq_render_scalar_kernel()->output(acc, count);
+}
+
+__attribute__((target("avx2")))
+static void mix_avx2(int16_t* acc, int16_t value, size_t count) {
+	const __m256i v = _mm256_set1_epi16(value);
+	for (; count >= 16; count -= 16, acc += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)acc);
+		_mm256_storeu_si256((__m256i*)acc, _mm256_add_epi16(a, v));
+	}
+	for (; count; count--, acc++) {
+		*acc += value;
+	}
+}
+
+__attribute__((target("avx2")))
+static size_t output_avx2(int16_t* acc, size_t count) {
+	size_t clipped = 0;
+#ifndef NO_CLIP_CHECK
+	const __m256i max = _mm256_set1_epi16(INT8_MAX);
+	const __m256i min = _mm256_set1_epi16(INT8_MIN);
+#endif
+	for (; count >= 16; count -= 16, acc += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)acc);
+#ifndef NO_CLIP_CHECK
+		__m256i out = _mm256_or_si256(_mm256_cmpgt_epi16(a, max), _mm256_cmpgt_epi16(min, a));
+		clipped += __builtin_popcount((uint32_t)_mm256_movemask_epi8(out)) / 2;
+		a = _mm256_min_epi16(_mm256_max_epi16(a, min), max);
+#endif
+		_mm256_storeu_si256((__m256i*)acc, _mm256_slli_epi16(a, 8));
+	}
+	return clipped + seq_render_scalar_kernel()->output(acc, count);
+}
+
+static const struct seq_render_kernel_t sse2_kernel = {
+	mix_sse2,
+	output_sse2
+};
+
+static const struct seq_render_kernel_t avx2_kernel = {
+	mix_avx2,
+	output_avx2
+};
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+
+static void mix_neon(int16_t* acc, int16_t value, size_t count) {
+	const int16x8_t v = vdupq_n_s16(value);
+	for (; count >= 8; count -= 8, acc += 8) {
+		vst1q_s16(acc, vaddq_s16(vld1q_s16(acc), v));
+	}
+	for (; count; count--, acc++) {
+		*acc += value;
+	}
+}
+
+static size_t output_neon(int16_t* acc, size_t count) {
+	size_t clipped = 0;
+#ifndef NO_CLIP_CHECK
+	const int16x8_t max = vdupq_n_s16(INT8_MAX);
+	const int16x8_t min = vdupq_n_s16(INT8_MIN);
+#endif
+	for (; count >= 8; count -= 8, acc += 8) {
+		int16x8_t a = vld1q_s16(acc);
+#ifndef NO_CLIP_CHECK
+		uint16x8_t out = vorrq_u16(vcgtq_s16(a, max), vcltq_s16(a, min));
+		// 0xffff per clipped lane
+		clipped += vaddvq_u16(vshrq_n_u16(out, 15));
+		a = vminq_s16(vmaxq_s16(a, min), max);
+#endif
+		vst1q_s16(acc, vshlq_n_s16(a, 8));
+	}
+	return clipped + seq_render_scalar_kernel()->output(acc, count);
+}
+
+static const struct seq_render_kernel_t neon_kernel = {
+	mix_neon,
+	output_neon
+};
+#endif
+
+const struct seq_render_kernel_t* render_simd_select(const char* name) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if ((!name || !strcmp(name, "avx2")) && __builtin_cpu_supports("avx2")) {
+		return &avx2_kernel;
+	}
+	if ((!name || !strcmp(name, "sse2")) && __builtin_cpu_supports("sse2")) {
+		return &sse2_kernel;
+	}
+#elif defined(__ARM_NEON)
+	if (!name || !strcmp(name, "neon")) {
+		return &neon_kernel;
+	}
+#endif
+	return seq_render_scalar_kernel();
+}
+
+const char* render_simd_name(const struct seq_render_kernel_t* kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+	if (kernel == &avx2_kernel) {
+		return "avx2";
+	}
+	if (kernel == &sse2_kernel) {
+		return "sse2";
+	}
+#elif defined(__ARM_NEON)
+	if (kernel == &neon_kernel) {
+		return "neon";
+	}
+#endif
+	return "scalar";
+}
@@ -0,0 +1,34 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, SIMD render kernels.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+#ifndef _RENDER_SIMD_H
+#define _RENDER_SIMD_H
+
+#include "sequencer.h"
+
+/*! 
+ * Pick the best render kernel supported by the running CPU (`name` NULL), or 
+ * the one by name (avx2, sse2, neon, scalar). Falls back to the scalar kernel.
+ */
+const struct seq_render_kernel_t* render_simd_select(const char* name);
+
+/*! Name of the kernel returned by `render_simd_select` */
+const char* render_simd_name(const struct seq_render_kernel_t* kernel);
+
+#endif
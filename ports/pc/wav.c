@@ -0,0 +1,110 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, WAV file writer.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include "wav.h"
+#include <string.h>
+
+#define WAV_HEADER_SIZE 44
+/*! Large writes, the output is produced way faster than real-time */
+#define WAV_BUFFER_SIZE (1 << 16)
+
+static void put_le16(uint8_t* p, uint16_t value) {
+	p[0] = value & 0xff;
+	p[1] = value >> 8;
+}
+
+static void put_le32(uint8_t* p, uint32_t value) {
+	put_le16(p, value & 0xffff);
+	put_le16(p + 2, value >> 16);
+}
+
+static int write_header(struct wav_writer_t* writer, uint32_t data_size) {
+	uint8_t header[WAV_HEADER_SIZE];
+	memcpy(header, "RIFF", 4);
+	put_le32(header + 4, data_size + WAV_HEADER_SIZE - 8);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le32(header + 16, 16);
+	// PCM, mono, 16-bit
+	put_le16(header + 20, 1);
+	put_le16(header + 22, 1);
+	put_le32(header + 24, writer->rate);
+	put_le32(header + 28, writer->rate * 2);
+	put_le16(header + 32, 2);
+	put_le16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	put_le32(header + 40, data_size);
+	return fwrite(header, 1, WAV_HEADER_SIZE, writer->file) != WAV_HEADER_SIZE;
+}
+
+int wav_open(struct wav_writer_t* writer, const char* path, int rate, int raw) {
+	memset(writer, 0, sizeof(struct wav_writer_t));
+	writer->raw = raw;
+	writer->rate = rate;
+	writer->file = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+	if (!writer->file) {
+		fprintf(stderr, "Cannot write the %s file\n", path);
+		return 1;
+	}
+	setvbuf(writer->file, NULL, _IOFBF, WAV_BUFFER_SIZE);
+
+	// Sizes unknown yet
+	if (!raw && write_header(writer, UINT32_MAX - WAV_HEADER_SIZE)) {
+		fprintf(stderr, "Cannot write the %s file\n", path);
+		if (writer->file != stdout) {
+			fclose(writer->file);
+		}
+		writer->file = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+int wav_write(struct wav_writer_t* writer, const int16_t* samples, size_t count) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	if (!writer->raw) {
+		// WAV is little-endian
+		for (size_t i = 0; i < count; i++) {
+			uint8_t sample[2];
+			put_le16(sample, samples[i]);
+			if (fwrite(sample, 1, 2, writer->file) != 2) {
+				return 1;
+			}
+		}
+		writer->data_size += count * 2;
+		return 0;
+	}
+#endif
+	writer->data_size += count * 2;
+	return fwrite(samples, sizeof(int16_t), count, writer->file) != count;
+}
+
+int wav_close(struct wav_writer_t* writer) {
+	int err = 0;
+	if (!writer->raw && fseek(writer->file, 0, SEEK_SET) == 0) {
+		err = write_header(writer, writer->data_size);
+	}
+	if (writer->file == stdout) {
+		err |= fflush(stdout) != 0;
+	} else {
+		err |= fclose(writer->file) != 0;
+	}
+	writer->file = NULL;
+	return err;
+}
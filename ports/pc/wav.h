@@ -0,0 +1,51 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PC port, WAV file writer.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+#ifndef _WAV_H
+#define _WAV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*! Buffered writer of 16-bit mono PCM, as WAV or raw file */
+struct wav_writer_t {
+	FILE* file;
+	/*! Raw PCM, no header */
+	int raw;
+	/*! Sample rate */
+	int rate;
+	/*! Bytes of samples written so far */
+	uint32_t data_size;
+};
+
+/*! 
+ * Open the output file. `path` "-" writes on stdout.
+ * The WAV header sizes are fixed up at `wav_close` when the file is seekable, 
+ * otherwise (e.g. a pipe) they are left to the maximum, as players and encoders expect in streams.
+ */
+int wav_open(struct wav_writer_t* writer, const char* path, int rate, int raw);
+
+/*! Append samples, in native byte order. */
+int wav_write(struct wav_writer_t* writer, const int16_t* samples, size_t count);
+
+/*! Fix up the header and close the file. */
+int wav_close(struct wav_writer_t* writer);
+
+#endif
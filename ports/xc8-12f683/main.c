@@ -18,13 +18,321 @@
     
 struct poly_synth_t synth;
 
-static const uint8_t* tune_ptr;
-static const uint8_t* tune_ptr_end;
+#ifdef PWM_FIFO_SIZE
+// Rendered samples, with free running indexes: the interrupt owns the head, the main loop the tail
+static volatile uint8_t pwm_fifo[PWM_FIFO_SIZE];
+static volatile uint8_t pwm_fifo_head;
+static volatile uint8_t pwm_fifo_tail;
+
+void __interrupt() isr() {
+    if (INTCONbits.T0IF) {
+        INTCONbits.T0IF = 0;
+        // On underrun, keep the last sample
+        if (pwm_fifo_head != pwm_fifo_tail) {
+            CCPR1L = pwm_fifo[pwm_fifo_head & (PWM_FIFO_SIZE - 1)];
+            pwm_fifo_head++;
+        }
+    }
+}
+#endif
+
+// The generated decoder only handles the fixed-width frames, in program memory
+#if defined(TUNE_GEN_DECODER) && !defined(TUNE_HUFFMAN) && !defined(TUNE_PATTERNS) && !defined(TUNE_EEPROM) && !defined(TUNE_PACK_COUNT)
+#define USE_GEN_DECODER
+#endif
+
+#if defined(TUNE_EEPROM) && defined(TUNE_PATTERNS)
+// A call or a return would write the EEPROM address and refill the buffer inside a sample
+#error "TUNE_EEPROM doesn't support the --patterns streams"
+#endif
+
+#ifdef TUNE_EEPROM
+// Open-drain lines: the latches are kept low, and a line is released (pulled up) as input
+#define SDA_TRIS TRISIObits.TRISIO0
+#define SCL_TRIS TRISIObits.TRISIO1
+#define SDA_IN GPIObits.GP0
+// SCL high for at least 0.6us (400kHz parts)
+#define I2C_DELAY() NOP(); NOP()
+
+// Start, or repeated start
+static void i2c_start() {
+    SDA_TRIS = 1;
+    SCL_TRIS = 1;
+    I2C_DELAY();
+    SDA_TRIS = 0;
+    I2C_DELAY();
+    SCL_TRIS = 0;
+}
+
+static void i2c_stop() {
+    SDA_TRIS = 0;
+    SCL_TRIS = 1;
+    I2C_DELAY();
+    SDA_TRIS = 1;
+}
+
+// The ACK is ignored: the EEPROM is never busy, it is only read
+static void i2c_write(uint8_t byte) {
+    for (uint8_t i = 8; i; i--, byte <<= 1) {
+        if (byte & 0x80) {
+            SDA_TRIS = 1;
+        } else {
+            SDA_TRIS = 0;
+        }
+        SCL_TRIS = 1;
+        I2C_DELAY();
+        SCL_TRIS = 0;
+    }
+    SDA_TRIS = 1;
+    SCL_TRIS = 1;
+    I2C_DELAY();
+    SCL_TRIS = 0;
+}
+
+static uint8_t i2c_read(uint8_t ack) {
+    uint8_t byte = 0;
+    for (uint8_t i = 8; i; i--) {
+        SCL_TRIS = 1;
+        I2C_DELAY();
+        byte <<= 1;
+        if (SDA_IN) {
+            byte |= 1;
+        }
+        SCL_TRIS = 0;
+    }
+    if (ack) {
+        SDA_TRIS = 0;
+    }
+    SCL_TRIS = 1;
+    I2C_DELAY();
+    SCL_TRIS = 0;
+    SDA_TRIS = 1;
+    return byte;
+}
+
+// The EEPROM address of the current byte of the stream
+typedef uint16_t tune_ptr_t;
+#define TUNE_DATA_START 0
+#else
+typedef const uint8_t* tune_ptr_t;
+#define TUNE_DATA_START tune_data
+#endif
+
+#ifndef USE_GEN_DECODER
+static tune_ptr_t tune_ptr;
+static tune_ptr_t tune_ptr_end;
+#ifndef TUNE_BYTE_ALIGNED
 static uint8_t tune_ptr_bits;
+#endif
+#ifdef TUNE_FRAME_COUNT
+// No terminator frame: the end is given by the frame count
+static uint16_t tune_frames;
+#endif
+
+#ifdef TUNE_PATTERNS
+// Call of an earlier run of frames: the position after the call, and the frames left
+static tune_ptr_t call_ptr;
+static uint8_t call_ptr_bits;
+static uint8_t call_left;
+#endif
+
+#ifdef TUNE_EEPROM
+/*
+ * The bytes from `tune_ptr` are read ahead from a sequential read of the EEPROM, that is left open:
+ * the EEPROM increments the address at every byte, so the address is only written at the tune start. 
+ * The byte of address A is in `eeprom_buf[A % EEPROM_BUF_SIZE]`.
+ */
+static uint8_t eeprom_buf[EEPROM_BUF_SIZE];
+// Address of the next byte of the sequential read
+static uint16_t eeprom_addr;
+static uint8_t eeprom_reading;
+// A frame was fetched in this sample
+static uint8_t eeprom_fetched;
+
+static void eeprom_read_next() {
+    eeprom_buf[(uint8_t)eeprom_addr & (EEPROM_BUF_SIZE - 1)] = i2c_read(1);
+    eeprom_addr++;
+}
+
+// Read the bytes missing from the buffer. A frame never spans more than EEPROM_BUF_SIZE bytes.
+// The prefetch keeps the buffer full, so this only reads after frames fetched in a row
+static void eeprom_fill() {
+    eeprom_fetched = 1;
+    while ((uint16_t)(eeprom_addr - tune_ptr) < EEPROM_BUF_SIZE) {
+        eeprom_read_next();
+    }
+}
+
+// Read a byte ahead if there is room, in the idle time of the main loop
+static void eeprom_prefetch() {
+    if ((uint16_t)(eeprom_addr - tune_ptr) < EEPROM_BUF_SIZE) {
+        eeprom_read_next();
+    }
+}
+
+// The last byte is not acknowledged before the stop
+static void eeprom_close() {
+    if (eeprom_reading) {
+        i2c_read(0);
+        i2c_stop();
+        eeprom_reading = 0;
+    }
+}
+
+// Random read: write the address, then restart the sequential read from it
+static void eeprom_seek(uint16_t addr) {
+    eeprom_close();
+    i2c_start();
+    i2c_write(EEPROM_I2C_ADDR << 1);
+    i2c_write((uint8_t)(addr >> 8));
+    i2c_write((uint8_t)addr);
+    i2c_start();
+    i2c_write((EEPROM_I2C_ADDR << 1) | 1);
+    eeprom_reading = 1;
+    eeprom_addr = addr;
+    eeprom_fill();
+}
+
+#define TUNE_BYTE(offset) eeprom_buf[(uint8_t)(tune_ptr + (offset)) & (EEPROM_BUF_SIZE - 1)]
+#define TUNE_SEEK(ptr) eeprom_seek(tune_ptr = (ptr))
+#define TUNE_FRAME_START() eeprom_fill()
+#else
+#define TUNE_BYTE(offset) tune_ptr[offset]
+#define TUNE_SEEK(ptr) tune_ptr = (ptr)
+#define TUNE_FRAME_START()
+#endif
+
+#ifdef TUNE_PACK_LOCAL_REFS
+// The frame refs index the local table of the tune, of refs to the shared tables
+static uint16_t local_adsr_time_scale, local_wf_period, local_wf_amplitude, local_adsr_release_start;
+#define LOCAL_REF(field, ref) tune_pack_##field##_locals[local_##field + (ref)]
+#else
+#define LOCAL_REF(field, ref) (ref)
+#endif
+
+#ifndef USE_GEN_DECODER
+// Rewind the stream to the tune start
+static void tune_select(uint8_t index) {
+#ifdef TUNE_PACK_COUNT
+    // The tune span in the directory
+    TUNE_SEEK(TUNE_DATA_START + tune_pack_offsets[index]);
+    tune_ptr_end = TUNE_DATA_START + tune_pack_offsets[index + 1] - 1;
+#ifdef TUNE_FRAME_COUNT
+    tune_frames = tune_pack_frames[index];
+#endif
+#ifdef TUNE_PACK_LOCAL_REFS
+    local_adsr_time_scale = tune_pack_adsr_time_scale_bases[index];
+    local_wf_period = tune_pack_wf_period_bases[index];
+    local_wf_amplitude = tune_pack_wf_amplitude_bases[index];
+    local_adsr_release_start = tune_pack_adsr_release_start_bases[index];
+#endif
+#else
+    TUNE_SEEK(TUNE_DATA_START);
+    tune_ptr_end = TUNE_DATA_START + TUNE_DATA_SIZE - 1;
+#ifdef TUNE_FRAME_COUNT
+    tune_frames = TUNE_FRAME_COUNT;
+#endif
+#endif
+#ifndef TUNE_BYTE_ALIGNED
+    tune_ptr_bits = 0;
+#endif
+#ifdef TUNE_PATTERNS
+    call_left = 0;
+#endif
+}
+#endif
+
+#ifdef ADSR_GAIN
+// The release start field is the row of the gain table
+#define RELEASE_START_VALUE(ref) LOCAL_REF(adsr_release_start, ref)
+#else
+#define RELEASE_START_VALUE(ref) tune_adsr_release_start_refs[LOCAL_REF(adsr_release_start, ref)]
+#endif
+
+#ifdef TUNE_PERIOD_DELTA
+// The period field is the interval from the last period ref of the voice
+#define PERIOD_VALUE(ref) tune_wf_period_refs[LOCAL_REF(wf_period, cur_voice->period_ref += tune_wf_period_deltas[ref])]
+#else
+#define PERIOD_VALUE(ref) tune_wf_period_refs[LOCAL_REF(wf_period, ref)]
+#endif
+
+#ifdef TUNE_HUFFMAN
+static uint8_t read_bit() {
+    uint8_t bit = (TUNE_BYTE(0) >> tune_ptr_bits) & 1;
+    if (++tune_ptr_bits == 8) {
+        tune_ptr_bits = 0;
+        tune_ptr++;
+    }
+    return bit;
+}
+
+// Canonical code, MSB first. `counts` is the count of codes of each length.
+static uint8_t read_code(const uint8_t* counts, uint8_t max_bits) {
+    uint16_t code = 0;
+    uint16_t first = 0;
+    uint8_t ref = 0;
+    for (uint8_t i = 0; i < max_bits; i++) {
+        code |= read_bit();
+        uint8_t count = counts[i];
+        if (code - first < count) {
+            return ref + (uint8_t)(code - first);
+        }
+        ref += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    // Single value
+    return 0;
+}
+
+void new_frame_require() {
+    if (!tune_frames) {
+        seq_buf_frame.adsr_time_scale_1 = 0;
+        return;
+    }
+    tune_frames--;
+    TUNE_FRAME_START();
+    seq_buf_frame.adsr_time_scale_1 = tune_adsr_time_scale_refs[read_code(tune_adsr_time_scale_codes, CODE_BITS_ADSR_TIME_SCALE)];
+    seq_buf_frame.wf_period = PERIOD_VALUE(read_code(tune_wf_period_codes, CODE_BITS_WF_PERIOD));
+    seq_buf_frame.wf_amplitude = tune_wf_amplitude_refs[read_code(tune_wf_amplitude_codes, CODE_BITS_WF_AMPLITUDE)];
+    seq_buf_frame.adsr_release_start = RELEASE_START_VALUE(read_code(tune_adsr_release_start_codes, CODE_BITS_ADSR_RELEASE_START));
+}
+
+#else
+#ifdef TUNE_BYTE_ALIGNED
+// Whole frames of TUNE_FRAME_BYTES: no bit offset to track, the fields are at constant shifts
+#if TUNE_FRAME_BYTES == 1
+typedef uint8_t frame_t;
+#elif TUNE_FRAME_BYTES == 2
+typedef uint16_t frame_t;
+#else
+typedef uint32_t frame_t;
+#endif
 
+#define SHIFT_WF_PERIOD BITS_ADSR_TIME_SCALE
+#define SHIFT_WF_AMPLITUDE (SHIFT_WF_PERIOD + BITS_WF_PERIOD)
+#define SHIFT_ADSR_RELEASE_START (SHIFT_WF_AMPLITUDE + BITS_WF_AMPLITUDE)
+#define FRAME_FIELD(shift, bits) ((uint8_t)(frame >> (shift)) & ((1 << (bits)) - 1))
+
+static frame_t frame;
+
+static void read_frame() {
+    frame = TUNE_BYTE(0);
+#if TUNE_FRAME_BYTES > 1
+    frame |= (frame_t)TUNE_BYTE(1) << 8;
+#endif
+#if TUNE_FRAME_BYTES > 2
+    frame |= (frame_t)TUNE_BYTE(2) << 16;
+#endif
+#if TUNE_FRAME_BYTES > 3
+    frame |= (frame_t)TUNE_BYTE(3) << 24;
+#endif
+    tune_ptr += TUNE_FRAME_BYTES;
+}
+#else
 // Return it unmasked
 static uint8_t read_bits(uint8_t bits) {
-    uint16_t buffer = *tune_ptr + (uint16_t)(*(tune_ptr + 1) << 8);
+    uint16_t buffer = TUNE_BYTE(0) + (uint16_t)(TUNE_BYTE(1) << 8);
     buffer >>= tune_ptr_bits;
     tune_ptr_bits += bits;
     if (tune_ptr_bits >= 8) {
@@ -33,12 +341,58 @@ static uint8_t read_bits(uint8_t bits) {
     }
     return (uint8_t)buffer;
 }
+#endif
+
+#ifdef TUNE_BYTE_ALIGNED
+void new_frame_require() {
+    TUNE_FRAME_START();
+    read_frame();
+#if BITS_ADSR_TIME_SCALE > 0
+	uint8_t ref_adsr_time_scale = FRAME_FIELD(0, BITS_ADSR_TIME_SCALE);
+#endif
+#if BITS_WF_PERIOD > 0
+	uint8_t ref_wf_period = FRAME_FIELD(SHIFT_WF_PERIOD, BITS_WF_PERIOD);
+#endif
+#if BITS_WF_AMPLITUDE > 0
+	uint8_t ref_wf_amplitude = FRAME_FIELD(SHIFT_WF_AMPLITUDE, BITS_WF_AMPLITUDE);
+#endif
+#if BITS_ADSR_RELEASE_START > 0
+	uint8_t ref_adsr_release_start = FRAME_FIELD(SHIFT_ADSR_RELEASE_START, BITS_ADSR_RELEASE_START);
+#endif
 
+    // Only the terminator frame is past the data
+	if (tune_ptr > tune_ptr_end) {
+#else
 // Slow
 void new_frame_require() {
+#ifdef TUNE_FRAME_COUNT
+    if (!tune_frames) {
+        seq_buf_frame.adsr_time_scale_1 = 0;
+        return;
+    }
+    tune_frames--;
+#endif
+    TUNE_FRAME_START();
 #if BITS_ADSR_TIME_SCALE > 0
 	uint8_t ref_adsr_time_scale = read_bits(BITS_ADSR_TIME_SCALE) & ((1 << BITS_ADSR_TIME_SCALE) - 1);
 #endif
+#ifdef TUNE_PATTERNS
+    if (ref_adsr_time_scale == PATTERN_CALL) {
+#if PATTERN_PTR_BITS > 8
+        uint16_t pos = read_bits(8);
+        pos |= (uint16_t)(read_bits(PATTERN_PTR_BITS - 8) & ((1 << (PATTERN_PTR_BITS - 8)) - 1)) << 8;
+#else
+        uint16_t pos = read_bits(PATTERN_PTR_BITS) & ((1 << PATTERN_PTR_BITS) - 1);
+#endif
+        call_left = (read_bits(PATTERN_LEN_BITS) & ((1 << PATTERN_LEN_BITS) - 1)) + STREAM_PATTERN_MIN_LEN;
+        call_ptr = tune_ptr;
+        call_ptr_bits = tune_ptr_bits;
+        // The called frames are never calls
+        TUNE_SEEK(TUNE_DATA_START + (pos >> 3));
+        tune_ptr_bits = pos & 7;
+        ref_adsr_time_scale = read_bits(BITS_ADSR_TIME_SCALE) & ((1 << BITS_ADSR_TIME_SCALE) - 1);
+    }
+#endif
 #if BITS_WF_PERIOD > 0
 	uint8_t ref_wf_period = read_bits(BITS_WF_PERIOD) & ((1 << BITS_WF_PERIOD) - 1);
 #endif
@@ -48,7 +402,14 @@ void new_frame_require() {
 #if BITS_ADSR_RELEASE_START > 0
 	uint8_t ref_adsr_release_start = read_bits(BITS_ADSR_RELEASE_START) & ((1 << BITS_ADSR_RELEASE_START) - 1);
 #endif
+#ifdef TUNE_PATTERNS
+    if (call_left && !--call_left) {
+        TUNE_SEEK(call_ptr);
+        tune_ptr_bits = call_ptr_bits;
+    }
+#endif
 
+#ifndef TUNE_FRAME_COUNT
 	if (tune_ptr >= (tune_ptr_end - 1)
 #if BITS_ADSR_TIME_SCALE > 0
             && !ref_adsr_time_scale
@@ -63,30 +424,36 @@ void new_frame_require() {
             && !ref_adsr_release_start
 #endif
             ) {
+#endif
+#endif
+#if defined(TUNE_BYTE_ALIGNED) || !defined(TUNE_FRAME_COUNT)
 		seq_buf_frame.adsr_time_scale_1 = 0;
-	} else {
+		return;
+	}
+#endif
 #if BITS_ADSR_TIME_SCALE > 0
-		seq_buf_frame.adsr_time_scale_1 = tune_adsr_time_scale_refs[ref_adsr_time_scale];
+	seq_buf_frame.adsr_time_scale_1 = tune_adsr_time_scale_refs[LOCAL_REF(adsr_time_scale, ref_adsr_time_scale)];
 #else
-		seq_buf_frame.adsr_time_scale_1 = tune_adsr_time_scale_refs[0];
+	seq_buf_frame.adsr_time_scale_1 = tune_adsr_time_scale_refs[LOCAL_REF(adsr_time_scale, 0)];
 #endif
 #if BITS_WF_PERIOD > 0
-		seq_buf_frame.wf_period = tune_wf_period_refs[ref_wf_period];
+	seq_buf_frame.wf_period = PERIOD_VALUE(ref_wf_period);
 #else
-		seq_buf_frame.wf_period = tune_wf_period_refs[0];
+	seq_buf_frame.wf_period = PERIOD_VALUE(0);
 #endif
 #if BITS_WF_AMPLITUDE > 0
-		seq_buf_frame.wf_amplitude = tune_wf_amplitude_refs[ref_wf_amplitude];
+	seq_buf_frame.wf_amplitude = tune_wf_amplitude_refs[LOCAL_REF(wf_amplitude, ref_wf_amplitude)];
 #else
-		seq_buf_frame.wf_amplitude = tune_wf_amplitude_refs[0];
+	seq_buf_frame.wf_amplitude = tune_wf_amplitude_refs[LOCAL_REF(wf_amplitude, 0)];
 #endif
 #if BITS_ADSR_RELEASE_START > 0
-		seq_buf_frame.adsr_release_start = tune_adsr_release_start_refs[ref_adsr_release_start];
+	seq_buf_frame.adsr_release_start = RELEASE_START_VALUE(ref_adsr_release_start);
 #else
-		seq_buf_frame.adsr_release_start = tune_adsr_release_start_refs[0];
+	seq_buf_frame.adsr_release_start = RELEASE_START_VALUE(0);
 #endif
-	}
 }
+#endif // TUNE_HUFFMAN
+#endif
 
 void main() {
     while (1) {
@@ -120,10 +487,35 @@ void main() {
         TRISIObits.TRISIO2 = 0;
         CCP1CONbits.DC1B = 0;
 
+#ifdef TUNE_EEPROM
+        // Digital I/O on GP0 and GP1, released. The latches stay low
+        ANSEL = 0;
+        CMCON0 = 7;
+        TRISIObits.TRISIO0 = 1;
+        TRISIObits.TRISIO1 = 1;
+        GPIO &= 0xfc;
+#endif
+
+#ifdef PWM_FIFO_SIZE
+        // The interrupt writes the samples at every Timer0 overflow
+        pwm_fifo_head = pwm_fifo_tail = 0;
+        INTCONbits.T0IF = 0;
+        INTCONbits.T0IE = 1;
+        INTCONbits.GIE = 1;
+#endif
+
+#ifdef TUNE_PACK_COUNT
+        // Every tune of the pack, in order
+        for (uint8_t count = 0; count < TUNE_PACK_COUNT; count++) {
+            tune_select(count);
+#else
         for (uint8_t count = 3; count; count--) {
-            tune_ptr = tune_data;
-            tune_ptr_end = tune_data + TUNE_DATA_SIZE - 1;
-            tune_ptr_bits = 0;
+#ifdef USE_GEN_DECODER
+            tune_decoder_reset();
+#else
+            tune_select(0);
+#endif
+#endif
             seq_end = 0;
             cur_voice = &synth.voice[0];
             for (uint8_t i = 0; i < VOICE_COUNT; i++, cur_voice++) {
@@ -133,15 +525,45 @@ void main() {
             seq_play_stream(SEQ_CHANNEL_COUNT);
 
             while (!seq_end) {
+#ifdef PWM_FIFO_SIZE
+                // From +128 to -128
+                uint8_t sample = (uint8_t)(seq_feed_synth()) + 128;
 
+                // Wait for a free entry. Timer0 doesn't run in SLEEP, so the CPU can't sleep here
+                while ((uint8_t)(pwm_fifo_tail - pwm_fifo_head) == PWM_FIFO_SIZE) {
+#ifdef TUNE_EEPROM
+                    eeprom_prefetch();
+#endif
+                }
+                pwm_fifo[pwm_fifo_tail & (PWM_FIFO_SIZE - 1)] = sample;
+                pwm_fifo_tail++;
+#else
                 // From +128 to -128
                 CCPR1L = (uint8_t)(seq_feed_synth()) + 128;            
 
+#ifdef TUNE_EEPROM
+                // Read ahead in the samples with no frame fetch, as SEQ_PREFETCH does
+                if (!eeprom_fetched) {
+                    eeprom_prefetch();
+                }
+                eeprom_fetched = 0;
+#endif
                 // Wait for next sampling op
                 while (!INTCONbits.T0IF);
                 INTCONbits.T0IF = 0;
+#endif
             }
         }
+#ifdef TUNE_EEPROM
+        eeprom_close();
+#endif
+
+#ifdef PWM_FIFO_SIZE
+        // Play the last samples
+        while (pwm_fifo_head != pwm_fifo_tail);
+        INTCONbits.GIE = 0;
+        INTCONbits.T0IE = 0;
+#endif
 
         // HALT PWM and set 0 to save battery
         CCP1CONbits.CCP1M = 0x0;
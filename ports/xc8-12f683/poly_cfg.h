@@ -35,4 +35,48 @@
 
 #define VOICE_COUNT SEQ_CHANNEL_COUNT
 
+/*! Unroll the voice loop of `seq_feed_synth` on SEQ_CHANNEL_COUNT, with the voices addressed directly instead of through FSR */
+#define SEQ_UNROLL
+
+/*! Use the frame decoder generated in tune_gen.c for the tune, instead of the generic one of main.c */
+#define TUNE_GEN_DECODER
+
+/*! 
+ * Samples rendered ahead of the output (power of 2), written to the PWM by the Timer0 interrupt.
+ * The samples that take longer than the Timer0 period, e.g. with a frame fetch, are absorbed by the
+ * FIFO instead of delaying the output. Remove it to write the PWM from the main loop.
+ */
+#define PWM_FIFO_SIZE 8
+
+/*! 
+ * Take the ADSR gains from the `tune_adsr_gains` table of the tune, with a lookup per state transition
+ * instead of the state chain of `adsr_next`. The table takes ADSR_GAIN_STATES (66) words of program 
+ * memory per release start value of the tune, so it is left to the tunes that have room for it.
+ */
+// #define ADSR_GAIN(release_start, state_counter) tune_adsr_gains[release_start][state_counter]
+
+/*!
+ * Stream the tune data from an I2C serial EEPROM with 2 address bytes (24xx32 to 24xx512), flashed with the 
+ * `tune_gen.bin` image written by `compile-mml`, instead of the `tune_data` array in program memory. 
+ * The EEPROM is on GP0 (SDA) and GP1 (SCL), with pull-ups: the other free pins are taken by the crystal.
+ * The stream is a single sequential read, buffered ahead in the idle time of the main loop (in the samples 
+ * with no frame fetch, without PWM_FIFO_SIZE), so no byte costs an address cycle. The generic decoder of main.c 
+ * is used. Not with the `--patterns` streams: their calls and returns would restart the read inside a sample.
+ */
+// #define TUNE_EEPROM
+/*! 7-bit address of the EEPROM */
+#define EEPROM_I2C_ADDR 0x50
+/*! Bytes read ahead (power of 2), at least the longest frame with its bit offset */
+#define EEPROM_BUF_SIZE 8
+
+/*! 
+ * Only the tunes with delta-coded periods need the last period ref in the voices.
+ * The other ones decode the next frame ahead, in the samples without feed (1 byte of RAM)
+ */
+#ifdef TUNE_PERIOD_DELTA
+#define SEQ_PERIOD_DELTA
+#else
+#define SEQ_PREFETCH
+#endif
+
 #endif
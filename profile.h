@@ -0,0 +1,75 @@
+/*!
+ * Polyphonic synthesizer for microcontrollers.  PIC cycle cost model.
+ * (C) 2017 Stuart Longland - Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+/*!
+ * Host-side cost model of the PIC12F683 port, enabled by PROFILE_CYCLES (see `make PROFILE=1` of the PC port).
+ * Every code path of the engine adds its instruction cycles to `profile_cycles`, so the port can 
+ * measure the cycles of every sample of a tune against the Timer0 period.
+ * The costs are estimates of the XC8 (free mode) output: one cycle per instruction, two for the jumps, 
+ * no hardware shift, 16-bit operations in 4-6 instructions. Calibrate them with the MPLAB stopwatch.
+ */
+
+/*! Instruction clock of the PIC port (HS 20MHz oscillator, Fosc/4) */
+#ifndef PROFILE_FOSC
+#define PROFILE_FOSC 20000000
+#endif
+/*! Cycles available per sample at SYNTH_FREQ */
+#define PROFILE_SAMPLE_CYCLES ((uint32_t)(PROFILE_FOSC / 4) / SYNTH_FREQ)
+
+/*! Main loop (PWM update, Timer0 wait) and `seq_feed_synth` call, return and voice loop set-up */
+#define PROFILE_COST_SAMPLE			36
+/*! Clipping of the mixed sample. Added by the port, since the PIC skips it for the tunes compiled with NO_CLIP_CHECK */
+#define PROFILE_COST_CLIP			14
+/*! `seq_feed_synth` loop, per voice: `voice_ch_next` call and the sum */
+#define PROFILE_COST_VOICE			16
+/*! `seq_feed_synth` unrolled with SEQ_UNROLL, per voice: no loop counter and pointer increment, direct gain read */
+#define PROFILE_COST_VOICE_UNROLLED	10
+/*! `adsr_next`: 16-bit countdown to the next event */
+#define PROFILE_COST_ADSR_WAIT		9
+/*! `adsr_next`: voice at the end of the envelope */
+#define PROFILE_COST_ADSR_END		8
+/*! `adsr_next`: state transition, with the comparison chain and the reload of the countdown */
+#define PROFILE_COST_ADSR_EVENT		34
+/*! `voice_ch_next`: each step of `value >>= gain` (signed right shift) */
+#define PROFILE_COST_GAIN_SHIFT		4
+/*! `voice_wf_next`: 16-bit period countdown */
+#define PROFILE_COST_WF_STEP		14
+/*! `voice_wf_next`: square wave swap and period reload */
+#define PROFILE_COST_WF_SWAP		15
+/*! Frame fetch: `new_frame_require` call, `voice_wf_set` and `adsr_config` */
+#define PROFILE_COST_FETCH			52
+/*! Frame fetch: each field, table lookup of the value */
+#define PROFILE_COST_FETCH_FIELD	12
+/*! Frame fetch: each bit read by the generic bit reader (`read_bits` and the Huffman decoder) */
+#define PROFILE_COST_FETCH_BIT		11
+/*! Frame fetch: each byte loaded by the byte-aligned and generated decoders */
+#define PROFILE_COST_FETCH_BYTE		7
+/*! Frame fetch: STREAM_PERIOD_DELTA sum of the period ref */
+#define PROFILE_COST_FETCH_DELTA	6
+
+#ifdef PROFILE_CYCLES
+#define PROFILE_COST(cycles) (profile_cycles += (cycles))
+#else
+#define PROFILE_COST(cycles)
+#endif
+
+#endif
@@ -20,50 +20,164 @@
 
 #include "sequencer.h"
 #include "synth.h"
+#ifdef SEQ_STATS
+#include <string.h>
+#endif
+
+#if defined(SEQ_PREFETCH) && defined(SEQ_PERIOD_DELTA)
+// The delta-coded periods are decoded against the voice being fed, not known ahead
+#error "SEQ_PREFETCH requires absolute period refs"
+#endif
 
+#if defined(SEQ_UNROLL) && !defined(SEQ_CHANNEL_COUNT)
+// The unrolled voice loop is specialized on the voice count of the tune
+#error "SEQ_UNROLL requires SEQ_CHANNEL_COUNT"
+#elif defined(SEQ_UNROLL) && SEQ_CHANNEL_COUNT > 8
+#error "SEQ_UNROLL supports up to 8 voices"
+#endif
+
+#ifndef SYNTH_REENTRANT
 /*! State used between `seq_play_stream` and `seq_feed_synth` */
 #ifndef SEQ_CHANNEL_COUNT
-static uint8_t seq_voice_count;
-#else
-#define seq_voice_count SEQ_CHANNEL_COUNT
+uint8_t seq_voice_count;
 #endif
 
 uint8_t seq_end = 0;
 struct seq_frame_t seq_buf_frame;
 struct voice_ch_t* cur_voice;
+#ifdef SEQ_PREFETCH
+uint8_t seq_buf_ready;
+#endif
+#ifdef PROFILE_CYCLES
+uint32_t profile_cycles;
+#endif
+#ifdef SEQ_STATS
+struct seq_stats_t seq_stats;
+#endif
+#endif
 
-void seq_play_stream(uint8_t voices) {
+void seq_play_stream(SYNTH_CTX_PARAM_ uint8_t voices) {
 #ifndef SEQ_CHANNEL_COUNT
 	seq_voice_count = voices;
 #endif
 
 	// Disable all channels
     seq_end = 0;
+#ifdef SEQ_PREFETCH
+	seq_buf_ready = 0;
+#endif
+#ifdef SEQ_STATS
+	memset(&seq_stats, 0, sizeof(seq_stats));
+#endif
+#ifdef SEQ_PERIOD_DELTA
+	for (uint8_t i = 0; i < seq_voice_count; i++) {
+		synth.voice[i].period_ref = 0;
+	}
+#endif
 }
 
-int8_t seq_feed_synth() {
+/*! Feed `cur_voice` with the next frame. Returns 0 at the end of the stream */
+static uint8_t seq_feed_voice(SYNTH_CTX_PARAM) {
+	PROFILE_COST(PROFILE_COST_FETCH);
+#ifdef SEQ_PREFETCH
+	if (!seq_buf_ready) {
+		// Fed on two samples in a row: no time to decode ahead
+		new_frame_require(SYNTH_CTX_ARG);
+	}
+	seq_buf_ready = 0;
+#else
+	new_frame_require(SYNTH_CTX_ARG);
+#endif
+	if (seq_buf_frame.adsr_time_scale_1 == 0) {
+		// End-of-stream
+		seq_end = 1;
+		return 0;
+	}
+
+	voice_wf_set(SYNTH_CTX_ARG_ &seq_buf_frame);
+	adsr_config(SYNTH_CTX_ARG_ &seq_buf_frame);
+	SEQ_STAT(frames, 1);
+	return 1;
+}
+
+#ifdef SEQ_UNROLL
+/*! 
+ * `voice_ch_next` and the feed of the voice `k`, with the voice state addressed directly.
+ * `adsr_next` and `voice_wf_next` still take the voice from `cur_voice`.
+ */
+#define SEQ_VOICE(k) \
+	cur_voice = &synth.voice[k]; \
+	PROFILE_COST(PROFILE_COST_VOICE_UNROLLED); \
+	adsr_next(SYNTH_CTX_ARG); \
+	if (synth.voice[k].adsr.gain < 6) { \
+		PROFILE_COST(synth.voice[k].adsr.gain * PROFILE_COST_GAIN_SHIFT); \
+		sample += (int8_t)(voice_wf_next(SYNTH_CTX_ARG) >> synth.voice[k].adsr.gain); \
+	} \
+	if (synth.voice[k].adsr.state_counter == ADSR_STATE_END) { \
+		SEQ_STAT(idle_samples[k], 1); \
+		if (fed) { \
+			SEQ_STAT(deferred_feeds, 1); \
+		} else { \
+			if (!seq_feed_voice(SYNTH_CTX_ARG)) { \
+				goto voices_end; \
+			} \
+			fed = 1; \
+		} \
+	}
+#endif
+
+int8_t seq_feed_synth(SYNTH_CTX_PARAM) {
 #ifndef NO_CLIP_CHECK
 	int16_t sample = 0;
 #else
 	int8_t sample = 0;
 #endif
+	PROFILE_COST(PROFILE_COST_SAMPLE);
 
-    cur_voice = &synth.voice[0];
     uint8_t fed = 0;
+#ifdef SEQ_UNROLL
+	// Same feed rule of the voice loop below: only the first voice in end state is fed
+	SEQ_VOICE(0)
+#if SEQ_CHANNEL_COUNT > 1
+	SEQ_VOICE(1)
+#endif
+#if SEQ_CHANNEL_COUNT > 2
+	SEQ_VOICE(2)
+#endif
+#if SEQ_CHANNEL_COUNT > 3
+	SEQ_VOICE(3)
+#endif
+#if SEQ_CHANNEL_COUNT > 4
+	SEQ_VOICE(4)
+#endif
+#if SEQ_CHANNEL_COUNT > 5
+	SEQ_VOICE(5)
+#endif
+#if SEQ_CHANNEL_COUNT > 6
+	SEQ_VOICE(6)
+#endif
+#if SEQ_CHANNEL_COUNT > 7
+	SEQ_VOICE(7)
+#endif
+voices_end:
+#else
+    cur_voice = &synth.voice[0];
     uint8_t i = seq_voice_count;
 	do {
-		sample += voice_ch_next();
+		sample += voice_ch_next(SYNTH_CTX_ARG);
+#ifdef SEQ_STATS
+		if (cur_voice->adsr.state_counter == ADSR_STATE_END) {
+			SEQ_STAT(idle_samples[cur_voice - synth.voice], 1);
+			if (fed) {
+				SEQ_STAT(deferred_feeds, 1);
+			}
+		}
+#endif
         if (!fed && cur_voice->adsr.state_counter == ADSR_STATE_END) {
             // Feed data
-			new_frame_require();
-            if (seq_buf_frame.adsr_time_scale_1 == 0) {
-                // End-of-stream
-				seq_end = 1;
-                break;
-            }
-
-            voice_wf_set(&seq_buf_frame);
-            adsr_config(&seq_buf_frame);
+			if (!seq_feed_voice(SYNTH_CTX_ARG)) {
+				break;
+			}
 
 			// Don't overload the CPU with multiple frames per sample
 			// This will create minimum phase errors (of 1 sample period) but will keep the process real-time on slower CPUs
@@ -72,6 +186,18 @@ int8_t seq_feed_synth() {
         i--;
         cur_voice++;
 	} while (i);
+#endif
+
+#ifdef SEQ_PREFETCH
+	if (!fed && !seq_buf_ready && !seq_end) {
+		// Decode the next frame in this sample, that has no feed, to keep the next feed short.
+		// The end of the stream is detected by the feed, at the same sample
+		new_frame_require(SYNTH_CTX_ARG);
+		seq_buf_ready = 1;
+	}
+#endif
+
+	SEQ_STAT(samples, 1);
 
 	/* Handle clipping */
 #ifndef NO_CLIP_CHECK
@@ -80,11 +206,13 @@ int8_t seq_feed_synth() {
 #ifdef CHECK_CLIPPING
 		clip_count++;
 #endif
+		SEQ_STAT(clipped, 1);
 	} else if (sample < INT8_MIN) {
 		sample = INT8_MIN;
 #ifdef CHECK_CLIPPING
 		clip_count++;
 #endif
+		SEQ_STAT(clipped, 1);
 	}
 #endif
 	return sample;
@@ -21,6 +21,27 @@
 #define _SEQUENCER_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include "poly_cfg.h"
+
+/*!
+ * Engine context. By default (microcontroller ports) the synth state is made of global variables,
+ * and these macros expand to nothing. Defining SYNTH_REENTRANT in `poly_cfg.h`, the engine functions
+ * take the engine instance (`struct synth_ctx_t`, see synth.h) as first argument, so more
+ * tunes can be rendered or compiled at the same time.
+ */
+#ifdef SYNTH_REENTRANT
+struct synth_ctx_t;
+#define SYNTH_CTX_PARAM		struct synth_ctx_t* ctx
+#define SYNTH_CTX_PARAM_	struct synth_ctx_t* ctx,
+#define SYNTH_CTX_ARG		ctx
+#define SYNTH_CTX_ARG_		ctx,
+#else
+#define SYNTH_CTX_PARAM
+#define SYNTH_CTX_PARAM_
+#define SYNTH_CTX_ARG
+#define SYNTH_CTX_ARG_
+#endif
 
 /*! 
  * Define a single step/frame of the sequencer. It applies to the active channel.
@@ -42,22 +63,58 @@ struct seq_frame_t {
  * The frames must then be sorted in the same fetch order and not in channel order.
  * Frames will be fed using the handler passed by `new_frame_require`.
  */
-void seq_play_stream(uint8_t voices);
+void seq_play_stream(SYNTH_CTX_PARAM_ uint8_t voices);
 
+#ifndef SYNTH_REENTRANT
 /*! Requires a new frame. The call never fails. Returns a zero frame at the end of the stream, or if EOF */
 extern struct seq_frame_t seq_buf_frame;
 
 /*! Set at the stream end */
 extern uint8_t seq_end;
 
+#ifdef SEQ_PREFETCH
+/*! Set when `seq_buf_frame` holds the next frame, decoded ahead in a sample without feed */
+extern uint8_t seq_buf_ready;
+#endif
+#endif
+
 /*! Requires a new frame to be written in `seq_buf_frame`. The call never fails. */
-void new_frame_require();
+void new_frame_require(SYNTH_CTX_PARAM);
 
 /*!
  * Use it when `seq_play_stream` is in use, must be called at every sample 
  * It call `poly_synth_next` internally.
 */
-int8_t seq_feed_synth();
+int8_t seq_feed_synth(SYNTH_CTX_PARAM);
+
+/*!
+ * Render up to `count` samples in one go, as 16-bit PCM (the 8-bit synth output scaled by 256).
+ * The output is the same of calling `seq_feed_synth` once per sample, frame fetch timing included.
+ * Returns the samples written, less than `count` only when the stream ends.
+ * Not meant for microcontroller usage.
+ */
+size_t seq_render_block(SYNTH_CTX_PARAM_ int16_t* out, size_t count);
+
+/*!
+ * Render `count` samples of the voices as they are, with no frame fetch: the voices 
+ * at the end of the envelope stay muted. Used to feed the voices from other sources than a stream, 
+ * e.g. live events. Same output format of `seq_render_block`.
+ */
+void seq_render_voices(SYNTH_CTX_PARAM_ int16_t* out, size_t count);
+
+/*! Inner loops of `seq_render_block`, replaceable by a port (e.g. with SIMD instructions) */
+struct seq_render_kernel_t {
+	/*! Add `value` to `count` samples of the accumulator */
+	void (*mix)(int16_t* acc, int16_t value, size_t count);
+	/*! Clip `count` accumulated samples to 8-bit and scale to 16-bit PCM, in place. Returns the count of clipped samples */
+	size_t (*output)(int16_t* acc, size_t count);
+};
+
+/*! The default, portable, kernel */
+const struct seq_render_kernel_t* seq_render_scalar_kernel();
+
+/*! Set the kernel used by `seq_render_block`. NULL restores the scalar one */
+void seq_render_set_kernel(const struct seq_render_kernel_t* kernel);
 
 /*! List of frames, used by `seq_frame_map_t` */
 struct seq_frame_list_t {
@@ -79,29 +136,137 @@ struct seq_frame_map_t {
 	struct seq_frame_list_t* channels;
 }; 
 
-/*! Compile/reorder a frame-map (by channel) to a sequential stream */
-void seq_compile(struct seq_frame_map_t* map, struct seq_frame_t** frame_stream, int* frame_count, int* voice_count, int* do_clip_check);
+/*! Simulate the synth timing one sample at a time, using the actual voices */
+#define SEQ_COMPILE_SAMPLES 0
+/*! Skip from one envelope end to the next one. Same output of SEQ_COMPILE_SAMPLES, way faster */
+#define SEQ_COMPILE_FAST 1
+
+/*! Print the MML, compiler and compression stats on stdout. Set by default */
+extern int seq_verbose;
+
+/*! Compile/reorder a frame-map (by channel) to a sequential stream. The mix is not played: see `seq_mix_peak` */
+void seq_compile(SYNTH_CTX_PARAM_ struct seq_frame_map_t* map, struct seq_frame_t** frame_stream, int* frame_count, int* voice_count, int mode);
+
+/*! 
+ * Play the frame stream on `voice_count` voices, with the feed rule of `seq_feed_synth`, and find the peak of the mix:
+ * the largest of the maximum sample and of the opposite of the minimum. Returns the count of the samples out of `int8_t`,
+ * so the tune needs the clip check. Not meant for microcontroller usage: it takes a playback of the whole tune.
+ */
+int seq_mix_peak(SYNTH_CTX_PARAM_ struct seq_frame_t* frame_stream, int frame_count, int voice_count, int* peak);
+
+/*! 
+ * Scale the amplitudes of the frame stream, played on `voice_count` voices with the mix `peak` of `seq_mix_peak`, 
+ * by `INT8_MAX` over the peak, so that the tune can be played without the clip check (NO_CLIP_CHECK). 
+ * Returns the count of the samples still out of `int8_t`, checked with one more playback.
+ */
+int seq_gain_stage(SYNTH_CTX_PARAM_ struct seq_frame_t* frame_stream, int frame_count, int voice_count, int peak);
 
 /*! Free the stream allocated by `seq_compile`. */
 void seq_free(struct seq_frame_t* seq_frame_stream);
 
+/*! Longest Huffman code of the STREAM_HUFFMAN layout */
+#define STREAM_HUFFMAN_MAX_BITS 12
+
 struct ref_map_t {
     int count;
     int* values;
     int bit_count;
+    /*! STREAM_HUFFMAN: count of the codes of length 1 to `code_bits`. The refs are in canonical code order */
+    int code_counts[STREAM_HUFFMAN_MAX_BITS];
+    int code_bits;
 };
 
+/*! 
+ * Pad every frame to whole bytes: the reader doesn't need to track the bit offset, and 
+ * the fields are at constant shifts. The stream ends with a single all-zero frame, and ends 
+ * exactly when the reader goes past the data.
+ */
+#define STREAM_BYTE_ALIGNED 1
+
+/*!
+ * Code every field with a canonical Huffman code, built from the field distribution: 
+ * the frequent refs take less bits. The refs with codes of the same length are consecutive
+ * in the ref table, so the decoder only needs the count of the codes of each length.
+ * The codes are written MSB first, and there is no terminator: the stream ends after `frame_count` frames.
+ */
+#define STREAM_HUFFMAN 2
+
+/*!
+ * Code the period ref as the interval (modulo 256) from the previous period ref of the same voice,
+ * through a table of the used intervals: the melodies move by a few notes, so the intervals are less than the notes.
+ * The voice of each frame is the one chosen by `seq_feed_synth`, and the decoder keeps the last ref in `voice_ch_t`.
+ * Passed to `stream_compress`, the delta coding is kept only if the stream gets smaller.
+ */
+#define STREAM_PERIOD_DELTA 4
+
+/*!
+ * Replace the repeated runs of frames with calls of their first occurrence. A call is an `adsr_time_scale` ref 
+ * equal to the count of the time scale refs, followed by the bit position of the run (`pattern_ptr_bits`) and 
+ * by its length minus STREAM_PATTERN_MIN_LEN (`pattern_len_bits`). The called runs only contain frames, 
+ * so the decoder only keeps a return position. Bit-packed layout only; passed to `stream_compress`, 
+ * the calls are kept only if the stream gets smaller.
+ */
+#define STREAM_PATTERNS 8
+
+/*! Shortest run of frames in a STREAM_PATTERNS call */
+#define STREAM_PATTERN_MIN_LEN 2
+
+/*! Widest length field of a STREAM_PATTERNS call, so that the longest run fits the `uint8_t` call counter of the decoders */
+#define STREAM_PATTERN_MAX_LEN_BITS 7
+
+/*!
+ * Set by `stream_compress_pack` on a pack of several tunes. The bit-packed tunes are then counted, so that they end
+ * as in their single-tune build: the end test of the zero terminator frames can miss the first one, played as a silent note.
+ */
+#define STREAM_PACK 16
+
+/*! The stream has no terminator frame, and ends after `frame_count` frames */
+#define STREAM_COUNTED_END(flags) (((flags) & (STREAM_HUFFMAN | STREAM_PATTERNS)) || (((flags) & (STREAM_PERIOD_DELTA | STREAM_PACK)) && !((flags) & STREAM_BYTE_ALIGNED)))
+
+/*! Bytes allocated after `data_size`, zeroed, so the readers can fetch whole words at the end of the stream */
+#define STREAM_PADDING 8
+
 struct bit_stream_t {
     struct ref_map_t refs_adsr_time_scale;
     struct ref_map_t refs_wf_period;
     struct ref_map_t refs_wf_amplitude;
     struct ref_map_t refs_adsr_release_start;
+    /*! STREAM_PERIOD_DELTA: the intervals of the period field */
+    struct ref_map_t refs_wf_period_delta;
     uint8_t* data;
     int data_size;
+    /*! Layout, STREAM_* flags */
+    int flags;
+    /*! Bits of a frame (the sum of the ref bit counts), and bytes when STREAM_BYTE_ALIGNED */
+    int frame_bits;
+    int frame_bytes;
+    /*! Frames in the stream, terminator excluded */
+    int frame_count;
+    /*! STREAM_PATTERNS: bits of the position and of the length of the calls */
+    int pattern_ptr_bits;
+    int pattern_len_bits;
+    /*! Tunes in the stream (see `stream_compress_pack`): the byte offset of each one, plus the end, and its frames */
+    int tune_count;
+    int* tune_offsets;
+    int* tune_frame_counts;
+    /*! 
+     * Packs with local ref tables, else NULL: by field in frame order (period as absolute refs), the shared refs 
+     * that each tune uses, and the offset of each tune in it, plus the end. The frame refs of a tune index its local table.
+     */
+    int* local_refs[4];
+    int* local_offsets[4];
 };
 
-/*! Compress the frame stream to bit-stream */
-int stream_compress(struct seq_frame_t* frame_stream, int frame_count, struct bit_stream_t* stream);
+/*! Compress the frame stream, played on `voice_count` voices, to bit-stream, with the STREAM_* layout `flags` */
+int stream_compress(struct seq_frame_t* frame_stream, int frame_count, int voice_count, struct bit_stream_t* stream, int flags);
+
+/*! 
+ * Compress the frame streams of `tune_count` tunes, all played on `voice_count` voices, in a single bit-stream:
+ * the ref tables are built on the frames of all the tunes, and each tune starts at a byte offset of the data, 
+ * with its own terminator or frame count (STREAM_PACK). Not with STREAM_PATTERNS.
+ * Without STREAM_HUFFMAN, the frame refs go through a local table per tune when it makes the frames narrow enough to pay for it.
+ */
+int stream_compress_pack(struct seq_frame_t* const* frame_streams, const int* frame_counts, int tune_count, int voice_count, struct bit_stream_t* stream, int flags);
 
 /*! Free the stream */
 void stream_free(struct bit_stream_t* stream);
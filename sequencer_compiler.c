@@ -25,7 +25,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef SYNTH_REENTRANT
 int clip_count = 0;
+#endif
+
+int seq_verbose = 1;
 
 struct compiler_channel_state_t {
 	/*! The positions of every channel in the input channel map */
@@ -42,10 +46,12 @@ struct compiler_state_t {
 	int stream_position;
 	/*! State of each channel */
 	struct compiler_channel_state_t* channels;
+	/*! Voices in use, one per non-empty channel: the other ones never leave `ADSR_STATE_END` */
+	int voice_count;
 };
 
 /*! Feed the first free channel and copy the selected frame in the output stream */
-static void seq_feed_channels(struct compiler_state_t* state) {
+static void seq_feed_channels(SYNTH_CTX_PARAM_ struct compiler_state_t* state) {
 	cur_voice = &synth.voice[0];
 	int voice_idx = 0;
 
@@ -57,8 +63,8 @@ static void seq_feed_channels(struct compiler_state_t* state) {
 				// Feed data
 				struct seq_frame_t* frame = &channel->frames[state->channels[voice_idx].position++];
 
-				voice_wf_set(frame);
-				adsr_config(frame);
+				voice_wf_set(SYNTH_CTX_ARG_ frame);
+				adsr_config(SYNTH_CTX_ARG_ frame);
 
 				state->out_stream[state->stream_position++] = *frame;
 				// Don't overload the CPU with multiple frames per sample
@@ -71,7 +77,160 @@ static void seq_feed_channels(struct compiler_state_t* state) {
 	}
 }
 
-void seq_compile(struct seq_frame_map_t* map, struct seq_frame_t** frame_stream, int* frame_count, int* voice_count, int* do_clip_check) {
+/*! 
+ * Simulate the synth one sample at a time, with the actual voices.
+ */
+static void seq_compile_samples(SYNTH_CTX_PARAM_ struct compiler_state_t* state) {
+	seq_feed_channels(SYNTH_CTX_ARG_ state);
+	int end;
+	do {
+		// poly_synth_next();
+		for (int i = 0; i < state->voice_count; i++) {
+			cur_voice = &synth.voice[i];
+			voice_ch_next(SYNTH_CTX_ARG);
+		}
+		seq_feed_channels(SYNTH_CTX_ARG_ state);
+
+		end = 1;
+		for (int i = 0; i < state->voice_count; i++) {
+			if (synth.voice[i].adsr.state_counter != ADSR_STATE_END) {
+				end = 0;
+				break;
+			}
+		}
+	} while(!end);
+}
+
+/*! 
+ * Jump from one `ADSR_STATE_END` to the next one, since the envelope duration is known upfront.
+ * Same fetch order of `seq_compile_samples` (one frame per sample, in voice order), stepping 
+ * sample by sample only when more voices are waiting for a frame.
+ */
+static void seq_compile_fast(struct compiler_state_t* state, int valid_channel_count) {
+	// The sample in which each voice reaches the end state. Free voices are already there.
+	uint32_t* end_time = malloc(sizeof(uint32_t) * valid_channel_count);
+	memset(end_time, 0, sizeof(uint32_t) * valid_channel_count);
+	struct seq_frame_list_t** lists = malloc(sizeof(struct seq_frame_list_t*) * valid_channel_count);
+	for (int map_idx = 0, voice_idx = 0; map_idx < state->input_map->channel_count; map_idx++) {
+		if (state->input_map->channels[map_idx].count > 0) {
+			lists[voice_idx++] = &state->input_map->channels[map_idx];
+		}
+	}
+
+	uint32_t time = 0;
+	while (1) {
+		// Feed the first free voice
+		for (int voice_idx = 0; voice_idx < valid_channel_count; voice_idx++) {
+			if (state->channels[voice_idx].position < lists[voice_idx]->count && end_time[voice_idx] <= time) {
+				struct seq_frame_t* frame = &lists[voice_idx]->frames[state->channels[voice_idx].position++];
+				state->out_stream[state->stream_position++] = *frame;
+				end_time[voice_idx] = time + ADSR_ENV_SAMPLES(frame->adsr_time_scale_1);
+				break;
+			}
+		}
+
+		// Skip to the next sample in which a voice is free
+		uint32_t next = UINT32_MAX;
+		for (int voice_idx = 0; voice_idx < valid_channel_count; voice_idx++) {
+			if (state->channels[voice_idx].position < lists[voice_idx]->count) {
+				uint32_t voice_next = end_time[voice_idx] > time ? end_time[voice_idx] : time + 1;
+				if (voice_next < next) {
+					next = voice_next;
+				}
+			}
+		}
+		if (next == UINT32_MAX) {
+			break;
+		}
+		time = next;
+	}
+
+	free(lists);
+	free(end_time);
+}
+
+/*! Play the frame stream as `seq_feed_synth` does, and find the peak of the mix. The voices are restored at the end */
+static int stream_mix_peak(SYNTH_CTX_PARAM_ struct seq_frame_t* frame_stream, int frame_count, int voice_count, int* peak) {
+	struct voice_ch_t saved[VOICE_COUNT];
+	memcpy(saved, synth.voice, sizeof(saved));
+	struct voice_ch_t* saved_voice = cur_voice;
+	memset(synth.voice, 0, sizeof(synth.voice));
+	for (int i = 0; i < VOICE_COUNT; i++) {
+		synth.voice[i].adsr.state_counter = ADSR_STATE_END;
+	}
+
+	int clipped = 0;
+	int max = 0;
+	int min = 0;
+	int pos = 0;
+	int end = 0;
+	while (!end) {
+		int sample = 0;
+		int fed = 0;
+		for (int i = 0; i < voice_count; i++) {
+			cur_voice = &synth.voice[i];
+			sample += voice_ch_next(SYNTH_CTX_ARG);
+			if (!fed && cur_voice->adsr.state_counter == ADSR_STATE_END) {
+				if (pos == frame_count) {
+					// The last sample only has the voices before the end
+					end = 1;
+					break;
+				}
+				voice_wf_set(SYNTH_CTX_ARG_ &frame_stream[pos]);
+				adsr_config(SYNTH_CTX_ARG_ &frame_stream[pos]);
+				pos++;
+				fed = 1;
+			}
+		}
+		if (sample > max) {
+			max = sample;
+		} else if (sample < min) {
+			min = sample;
+		}
+		clipped += sample > INT8_MAX || sample < INT8_MIN;
+	}
+
+	memcpy(synth.voice, saved, sizeof(saved));
+	cur_voice = saved_voice;
+	*peak = max > -min ? max : -min;
+	return clipped;
+}
+
+int seq_mix_peak(SYNTH_CTX_PARAM_ struct seq_frame_t* frame_stream, int frame_count, int voice_count, int* peak) {
+	int clipped = stream_mix_peak(SYNTH_CTX_ARG_ frame_stream, frame_count, voice_count, peak);
+	if (seq_verbose) {
+		printf("Compiler stats:\n");
+		if (clipped) {
+			printf("\tWARN: clip count: %d, peak %d (slower)\n", clipped, *peak);
+		} else {
+			printf("\tno clip, peak %d (faster)\n", *peak);
+		}
+	}
+	return clipped;
+}
+
+int seq_gain_stage(SYNTH_CTX_PARAM_ struct seq_frame_t* frame_stream, int frame_count, int voice_count, int peak) {
+	double scale = (double)INT8_MAX / peak;
+	for (int i = 0; i < frame_count; i++) {
+		int amplitude = (int)(frame_stream[i].wf_amplitude * scale);
+		// The quiet notes are kept audible
+		if (!amplitude && frame_stream[i].wf_amplitude) {
+			amplitude = frame_stream[i].wf_amplitude > 0 ? 1 : -1;
+		}
+		frame_stream[i].wf_amplitude = amplitude;
+	}
+
+	// The envelope shifts truncate, so the scaled mix is checked again
+	int scaled_peak;
+	int clipped = stream_mix_peak(SYNTH_CTX_ARG_ frame_stream, frame_count, voice_count, &scaled_peak);
+	if (seq_verbose) {
+		printf("\tgain staging: peak %d, amplitudes scaled by %.3f (%.1f dB), peak %d%s\n", peak, scale, 20 * log10(scale), scaled_peak, 
+			clipped ? ", WARN: still clipping (slower)" : "");
+	}
+	return clipped;
+}
+
+void seq_compile(SYNTH_CTX_PARAM_ struct seq_frame_map_t* map, struct seq_frame_t** frame_stream, int* frame_count, int* voice_count, int mode) {
 	int total_frame_count = 0;
 	// Skip empty channels
 	int valid_channel_count = 0;
@@ -98,33 +257,12 @@ void seq_compile(struct seq_frame_map_t* map, struct seq_frame_t** frame_stream,
 	state.input_map = map;
 	state.out_stream = *frame_stream;
 	state.stream_position = 0;
+	state.voice_count = valid_channel_count;
 
-	seq_feed_channels(&state);
-	int end;
-	do {
-		// poly_synth_next();
-		for (uint8_t i = 0; i < VOICE_COUNT; i++) {
-			cur_voice = &synth.voice[i];
-			voice_ch_next();
-		}
-		seq_feed_channels(&state);
-
-		end = 1;
-		for (int i = 0; i < VOICE_COUNT; i++) {
-			if (synth.voice[i].adsr.state_counter != ADSR_STATE_END) {
-				end = 0;
-				break;
-			}
-		}
-	} while(!end);
-
-	printf("Compiler stats:\n");
-	if (clip_count) {
-		printf("\tWARN: clip count: %d (slower)\n", clip_count);
-		*do_clip_check = 1;
+	if (mode == SEQ_COMPILE_FAST) {
+		seq_compile_fast(&state, valid_channel_count);
 	} else {
-		printf("\tno clip (faster)\n");
-		*do_clip_check = 0;
+		seq_compile_samples(SYNTH_CTX_ARG_ &state);
 	}
 
 	free(state.channels);
@@ -134,46 +272,181 @@ void seq_free(struct seq_frame_t* seq_frame_stream) {
 	free(seq_frame_stream);
 }
 
-struct distribution16_t {
-	// Distribution map
-	int map[0x10000];
-	// Reverse map, from value to index
-	int map_of_refs[0x10000];
+/*! Distribution of the values of a frame field */
+struct distribution_t {
+	/*! Field values, sorted by `distribution_calc` */
+	int* values;
+	/*! Number of values */
+	int count;
+	/*! Occurrences of each ref */
+	int* ref_counts;
 	struct ref_map_t refs;
+	/*! STREAM_HUFFMAN: code and code length of each ref, in value order */
+	int* codes;
+	int* code_lengths;
+	/*! STREAM_HUFFMAN: ref table in code order, see `distribution_huffman` */
+	int* code_values;
 };
 
-static struct distribution16_t dist_adsr_time_scale;
-static struct distribution16_t dist_wf_period;
-static struct distribution16_t dist_wf_amplitude;
-static struct distribution16_t dist_adsr_release_start;
-
-static void distribution_init(struct distribution16_t* dist) {
-	memset(dist->map, 0, 0x10000 * sizeof(int));
-	memset(dist->map_of_refs, 0xff, 0x10000 * sizeof(int));
+static void distribution_init(struct distribution_t* dist, int frame_count) {
+	dist->values = malloc(sizeof(int) * (frame_count + 1));
+	dist->count = 0;
+	dist->ref_counts = 0;
 	dist->refs.count = 0;
     dist->refs.values = 0;
+	dist->refs.code_bits = 0;
+	memset(dist->refs.code_counts, 0, sizeof(dist->refs.code_counts));
+	dist->codes = 0;
+	dist->code_lengths = 0;
+	dist->code_values = 0;
 }
 
-static void distribution_add(struct distribution16_t* dist, uint16_t value) {
-	if (!dist->map[value]) {
-		dist->refs.count++;
-	}
-	dist->map[value]++;
+static void distribution_add(struct distribution_t* dist, uint16_t value) {
+	dist->values[dist->count++] = value;
+}
+
+static int compare_int(const void* a, const void* b) {
+	int va = *(const int*)a;
+	int vb = *(const int*)b;
+	return (va > vb) - (va < vb);
 }
 
-static void distribution_calc(struct distribution16_t* dist) {
+static void distribution_calc(struct distribution_t* dist, const char* name) {
+	// Sort and unique: the refs are in ascending value order
+	qsort(dist->values, dist->count, sizeof(int), compare_int);
+	dist->refs.values = malloc(sizeof(int) * dist->count);
+	dist->ref_counts = malloc(sizeof(int) * dist->count);
+	int j = -1;
+	for (int i = 0; i < dist->count; i++) {
+		if (j < 0 || dist->values[i] != dist->refs.values[j]) {
+			j++;
+			dist->refs.values[j] = dist->values[i];
+			dist->ref_counts[j] = 0;
+		}
+		dist->ref_counts[j]++;
+	}
+	dist->refs.count = j + 1;
+
 	dist->refs.bit_count = ceil(log(dist->refs.count) / log(2));
-	printf("%d (%d bits)\n", dist->refs.count, dist->refs.bit_count);
-
-    dist->refs.values = malloc(sizeof(int) * dist->refs.count);
-    int j = 0;
-    for (int i = 0; i < 0x10000; i++) {
-        if (dist->map[i]) {
-            dist->refs.values[j] = i;
-            dist->map_of_refs[i] = j;
-            j++;
-        }
-    }
+	if (seq_verbose) {
+		printf("\t%s: %d (%d bits)\n", name, dist->refs.count, dist->refs.bit_count);
+	}
+}
+
+/*! Get the ref (index in the ref table) of a value */
+static int distribution_ref(const struct distribution_t* dist, uint16_t value) {
+	int key = value;
+	const int* ref = bsearch(&key, dist->refs.values, dist->refs.count, sizeof(int), compare_int);
+	return ref - dist->refs.values;
+}
+
+/*! 
+ * Huffman code lengths of the refs, no longer than STREAM_HUFFMAN_MAX_BITS. 
+ * Longer codes are avoided flattening the weights, until the tree is short enough.
+ */
+static void huffman_lengths(const int* counts, int n, int* lengths) {
+	if (n == 1) {
+		// No bits at all
+		lengths[0] = 0;
+		return;
+	}
+
+	// Leaves from 0 to n - 1, then inner nodes
+	int* weights = malloc(sizeof(int) * 2 * n);
+	int* parents = malloc(sizeof(int) * 2 * n);
+	for (int shift = 0; ; shift++) {
+		for (int i = 0; i < n; i++) {
+			weights[i] = ((counts[i] - 1) >> shift) + 1;
+			parents[i] = -1;
+		}
+		for (int node = n; node < 2 * n - 1; node++) {
+			// Merge the two lightest roots
+			int a = -1;
+			int b = -1;
+			for (int i = 0; i < node; i++) {
+				if (parents[i] >= 0) {
+					continue;
+				}
+				if (a < 0 || weights[i] < weights[a]) {
+					b = a;
+					a = i;
+				} else if (b < 0 || weights[i] < weights[b]) {
+					b = i;
+				}
+			}
+			weights[node] = weights[a] + weights[b];
+			parents[node] = -1;
+			parents[a] = node;
+			parents[b] = node;
+		}
+
+		int max_length = 0;
+		for (int i = 0; i < n; i++) {
+			lengths[i] = 0;
+			for (int j = i; parents[j] >= 0; j = parents[j]) {
+				lengths[i]++;
+			}
+			if (lengths[i] > max_length) {
+				max_length = lengths[i];
+			}
+		}
+		if (max_length <= STREAM_HUFFMAN_MAX_BITS) {
+			break;
+		}
+	}
+	free(weights);
+	free(parents);
+}
+
+/*! Build the canonical Huffman code of the refs, and the ref table in code order */
+static void distribution_huffman(struct distribution_t* dist, const char* name) {
+	int n = dist->refs.count;
+	dist->codes = malloc(sizeof(int) * n);
+	dist->code_lengths = malloc(sizeof(int) * n);
+	dist->code_values = malloc(sizeof(int) * n);
+	huffman_lengths(dist->ref_counts, n, dist->code_lengths);
+
+	// Canonical order: by code length, then by value. Codes are consecutive in each length
+	int code = 0;
+	int pos = 0;
+	int total_bits = 0;
+	dist->refs.code_bits = 0;
+	for (int length = 1; length <= STREAM_HUFFMAN_MAX_BITS; length++) {
+		for (int i = 0; i < n; i++) {
+			if (dist->code_lengths[i] == length) {
+				dist->codes[i] = code++;
+				dist->code_values[pos++] = dist->refs.values[i];
+				dist->refs.code_counts[length - 1]++;
+				dist->refs.code_bits = length;
+				total_bits += length * dist->ref_counts[i];
+			}
+		}
+		code <<= 1;
+	}
+	if (n == 1) {
+		dist->codes[0] = 0;
+		dist->code_values[0] = dist->refs.values[0];
+	}
+
+	if (seq_verbose) {
+		printf("\t%s: Huffman codes up to %d bits, %.2f bits on average\n", name, dist->refs.code_bits, dist->count ? (double)total_bits / dist->count : 0.0);
+	}
+}
+
+/*! Switch the ref table to the code order, after the stream is written */
+static void distribution_use_code_order(struct distribution_t* dist) {
+	free(dist->refs.values);
+	dist->refs.values = dist->code_values;
+	dist->code_values = 0;
+}
+
+/*! Free the distribution, but not the ref table */
+static void distribution_free(struct distribution_t* dist) {
+	free(dist->values);
+	free(dist->ref_counts);
+	free(dist->codes);
+	free(dist->code_lengths);
+	free(dist->code_values);
 }
 
 struct stream_writer_t {
@@ -197,83 +470,613 @@ static void write_bits(struct stream_writer_t* writer, uint8_t data, uint8_t bit
 	}
 }
 
-int stream_compress(struct seq_frame_t* frame_stream, int frame_count, struct bit_stream_t* stream) {
-	// Analyze the stream to extract the data ref tables
-	distribution_init(&dist_adsr_time_scale);
-	distribution_init(&dist_wf_period);
-	distribution_init(&dist_wf_amplitude);
-	distribution_init(&dist_adsr_release_start);
+/*! Write a Huffman code, MSB first */
+static void write_code(struct stream_writer_t* writer, const struct distribution_t* dist, int ref) {
+	for (int bit = dist->code_lengths[ref] - 1; bit >= 0; bit--) {
+		write_bits(writer, (dist->codes[ref] >> bit) & 1, 1);
+	}
+}
+
+/*! Frame fields, in stream order */
+enum {
+	FIELD_ADSR_TIME_SCALE,
+	FIELD_WF_PERIOD,
+	FIELD_WF_AMPLITUDE,
+	FIELD_ADSR_RELEASE_START,
+	FIELD_COUNT
+};
+
+/*! Size of the stream data, for the `fields` distributions and the field `values` of each frame */
+static int stream_data_size(struct distribution_t* const* fields, int* const* values, int frame_count, int flags) {
+	int bits = 0;
+	for (int f = 0; f < FIELD_COUNT; f++) {
+		bits += fields[f]->refs.bit_count;
+	}
+	if (flags & STREAM_HUFFMAN) {
+		int total_bits = 0;
+		for (int i = 0; i < frame_count; i++) {
+			for (int f = 0; f < FIELD_COUNT; f++) {
+				total_bits += fields[f]->code_lengths[distribution_ref(fields[f], values[f][i])];
+			}
+		}
+		return (total_bits + 7) / 8;
+	}
+	if (flags & STREAM_BYTE_ALIGNED) {
+		// One terminator frame
+		return (frame_count + 1) * (bits ? (bits + 7) / 8 : 1);
+	}
+	// The last two frames are all 0s, unless the frames are counted
+	int end_frames = STREAM_COUNTED_END(flags) ? 0 : 2;
+	return (int)ceil((frame_count + end_frames) * bits / 8.0);
+}
+
+/*! 
+ * Size of the streams of all the tunes, each one starting at a byte boundary. 
+ * The byte offset of every tune goes in `offsets`, when not NULL.
+ */
+static int pack_data_size(struct distribution_t* const* fields, int* const* values, const int* frame_counts, int tune_count, int flags, int* offsets) {
+	int size = 0;
+	int first = 0;
+	for (int t = 0; t < tune_count; t++) {
+		int* tune_values[FIELD_COUNT];
+		for (int f = 0; f < FIELD_COUNT; f++) {
+			tune_values[f] = values[f] + first;
+		}
+		if (offsets) {
+			offsets[t] = size;
+		}
+		size += stream_data_size(fields, tune_values, frame_counts[t], flags);
+		first += frame_counts[t];
+	}
+	return size;
+}
+
+/*! STREAM_PACK local ref table of a field */
+struct local_refs_t {
+	/*! The local ref of every shared ref, by tune: [tune * shared count + shared ref], -1 when unused by the tune */
+	int* refs;
+	/*! Offset of the local table of each tune, plus the end */
+	int* offsets;
+	/*! Bits of the largest local table */
+	int bit_count;
+};
+
+/*! Number the shared refs used by every tune, in shared order */
+static void local_refs_build(struct local_refs_t* local, const struct distribution_t* dist, const int* values, const int* frame_counts, int tune_count) {
+	int count = dist->refs.count;
+	local->refs = malloc(sizeof(int) * tune_count * count);
+	local->offsets = malloc(sizeof(int) * (tune_count + 1));
+	local->bit_count = 0;
+	memset(local->refs, 0xff, sizeof(int) * tune_count * count);
+	int* refs = local->refs;
+	local->offsets[0] = 0;
+	for (int t = 0; t < tune_count; t++, refs += count) {
+		for (int i = 0; i < frame_counts[t]; i++) {
+			refs[distribution_ref(dist, *values++)] = 0;
+		}
+		int local_count = 0;
+		for (int r = 0; r < count; r++) {
+			if (refs[r] == 0) {
+				refs[r] = local_count++;
+			}
+		}
+		int bits = ceil(log(local_count) / log(2));
+		if (bits > local->bit_count) {
+			local->bit_count = bits;
+		}
+		local->offsets[t + 1] = local->offsets[t] + local_count;
+	}
+}
 
+/*! The ref of a value of the tune: the local one with a local table */
+static int field_ref(const struct distribution_t* dist, const struct local_refs_t* local, int tune, uint16_t value) {
+	int ref = distribution_ref(dist, value);
+	return local ? local->refs[tune * dist->refs.count + ref] : ref;
+}
+
+/*! 
+ * Find the voice that plays each frame. This is the fetch rule of `seq_feed_synth` (a frame per sample at most, 
+ * to the first voice in `ADSR_STATE_END`), with the timing of `seq_compile_fast`. 
+ * It isn't the channel of the frame: when a channel is over, its voice is fed with the frames of the next channels.
+ */
+static void stream_voices(const struct seq_frame_t* frame_stream, int frame_count, int voice_count, uint8_t* voices) {
+	// The sample in which each voice reaches the end state
+	uint32_t* end_time = malloc(sizeof(uint32_t) * voice_count);
+	memset(end_time, 0, sizeof(uint32_t) * voice_count);
+	uint32_t time = 0;
 	for (int i = 0; i < frame_count; i++) {
-		struct seq_frame_t* frame = frame_stream + i;
+		int voice = -1;
+		while (voice < 0) {
+			uint32_t next = UINT32_MAX;
+			for (int v = 0; v < voice_count; v++) {
+				if (end_time[v] <= time) {
+					voice = v;
+					break;
+				}
+				if (end_time[v] < next) {
+					next = end_time[v];
+				}
+			}
+			if (voice < 0) {
+				time = next;
+			}
+		}
+		voices[i] = voice;
+		end_time[voice] = time + ADSR_ENV_SAMPLES(frame_stream[i].adsr_time_scale_1);
+		time++;
+	}
+	free(end_time);
+}
+
+/*! Buckets and longest candidate chain of the STREAM_PATTERNS match search */
+#define PATTERN_HASH_SIZE 4096
+#define PATTERN_MAX_CHAIN 256
+
+/*! Hash of the first STREAM_PATTERN_MIN_LEN frames at `frame` */
+static int pattern_hash(const uint8_t* refs, int frame) {
+	uint32_t hash = 0;
+	for (int i = frame * FIELD_COUNT; i < (frame + STREAM_PATTERN_MIN_LEN) * FIELD_COUNT; i++) {
+		hash = hash * 31 + refs[i];
+	}
+	return hash % PATTERN_HASH_SIZE;
+}
+
+/*! 
+ * Split the frames in frames and calls, with a greedy search of the longest earlier run of frames, 
+ * through hash chains of the frame positions. `refs` are the FIELD_COUNT refs of each frame as coded in the stream, 
+ * so the runs are the same for the decoder in the voice order and with the delta coding.
+ * For each frame that starts a call `call_length` is the length and `call_start` the first called frame,
+ * `call_length` is 0 for the frames written in the stream, and `bit_pos` their stream position.
+ * Returns the stream bits.
+ */
+static int pattern_parse(const uint8_t* refs, int frame_count, int frame_bits, int call_bits, int max_length, int* call_start, int* call_length, int* bit_pos) {
+	int* heads = malloc(sizeof(int) * PATTERN_HASH_SIZE);
+	int* chains = malloc(sizeof(int) * frame_count);
+	// The frames written in the stream
+	uint8_t* written = malloc(frame_count);
+	for (int i = 0; i < PATTERN_HASH_SIZE; i++) {
+		heads[i] = -1;
+	}
+
+	int bits = 0;
+	for (int i = 0; i < frame_count; ) {
+		int best_length = 0;
+		int best_start = 0;
+		if (i + STREAM_PATTERN_MIN_LEN <= frame_count) {
+			int chain = 0;
+			for (int j = heads[pattern_hash(refs, i)]; j >= 0 && chain < PATTERN_MAX_CHAIN; j = chains[j], chain++) {
+				// The called run is before the call, and made of written frames only
+				int length = 0;
+				while (length < max_length && i + length < frame_count && j + length < i && written[j + length] &&
+					!memcmp(refs + (j + length) * FIELD_COUNT, refs + (i + length) * FIELD_COUNT, FIELD_COUNT)) {
+					length++;
+				}
+				if (length > best_length) {
+					best_length = length;
+					best_start = j;
+				}
+			}
+		}
+
+		if (best_length >= STREAM_PATTERN_MIN_LEN && call_bits < best_length * frame_bits) {
+			call_start[i] = best_start;
+			call_length[i] = best_length;
+			for (int k = 0; k < best_length; k++) {
+				written[i + k] = 0;
+			}
+			bits += call_bits;
+			i += best_length;
+		} else {
+			call_length[i] = 0;
+			written[i] = 1;
+			bit_pos[i] = bits;
+			bits += frame_bits;
+			if (i + STREAM_PATTERN_MIN_LEN <= frame_count) {
+				int hash = pattern_hash(refs, i);
+				chains[i] = heads[hash];
+				heads[hash] = i;
+			}
+			i++;
+		}
+	}
+
+	free(heads);
+	free(chains);
+	free(written);
+	return bits;
+}
+
+/*! Write up to 16 bits, LSB first */
+static void write_bits16(struct stream_writer_t* writer, uint16_t data, uint8_t bits) {
+	if (bits > 8) {
+		write_bits(writer, data & 0xff, 8);
+		write_bits(writer, data >> 8, bits - 8);
+	} else {
+		write_bits(writer, data, bits);
+	}
+}
+
+int stream_compress(struct seq_frame_t* frame_stream, int frame_count, int voice_count, struct bit_stream_t* stream, int flags) {
+	return stream_compress_pack(&frame_stream, &frame_count, 1, voice_count, stream, flags);
+}
+
+int stream_compress_pack(struct seq_frame_t* const* frame_streams, const int* frame_counts, int tune_count, int voice_count, struct bit_stream_t* stream, int flags) {
+	if ((flags & STREAM_BYTE_ALIGNED) && (flags & STREAM_HUFFMAN)) {
+		fprintf(stderr, "Byte-aligned frames and Huffman codes can't be used together\n");
+		return 1;
+	}
+	if ((flags & STREAM_PATTERNS) && (flags & (STREAM_BYTE_ALIGNED | STREAM_HUFFMAN))) {
+		fprintf(stderr, "Pattern calls are only supported in the bit-packed layout\n");
+		return 1;
+	}
+	if ((flags & STREAM_PATTERNS) && tune_count > 1) {
+		// The call positions would be relative to each tune
+		fprintf(stderr, "Pattern calls are not supported in a pack of tunes\n");
+		return 1;
+	}
+	if (tune_count > 1) {
+		flags |= STREAM_PACK;
+	}
+	int frame_count = 0;
+	for (int t = 0; t < tune_count; t++) {
+		frame_count += frame_counts[t];
+	}
+
+	// Analyze the stream to extract the data ref tables
+	struct distribution_t dist_adsr_time_scale;
+	struct distribution_t dist_wf_period;
+	struct distribution_t dist_wf_amplitude;
+	struct distribution_t dist_adsr_release_start;
+	struct distribution_t dist_wf_period_delta;
+	distribution_init(&dist_adsr_time_scale, frame_count);
+	distribution_init(&dist_wf_period, frame_count);
+	distribution_init(&dist_wf_amplitude, frame_count);
+	distribution_init(&dist_adsr_release_start, frame_count);
+	distribution_init(&dist_wf_period_delta, frame_count);
+
+	// Field values of each frame, in stream order
+	int* values = malloc(sizeof(int) * FIELD_COUNT * frame_count);
+	int* field_values[FIELD_COUNT];
+	for (int f = 0; f < FIELD_COUNT; f++) {
+		field_values[f] = values + f * frame_count;
+	}
+	int* period_deltas = malloc(sizeof(int) * frame_count);
+
+	// The ref tables are shared by all the tunes
+	for (int i = 0, t = 0, first = 0; i < frame_count; i++) {
+		while (i - first == frame_counts[t]) {
+			first += frame_counts[t++];
+		}
+		const struct seq_frame_t* frame = frame_streams[t] + (i - first);
 		distribution_add(&dist_adsr_time_scale, frame->adsr_time_scale_1);
 		distribution_add(&dist_wf_period, frame->wf_period);
 		distribution_add(&dist_wf_amplitude, frame->wf_amplitude);
 		distribution_add(&dist_adsr_release_start, frame->adsr_release_start);
+		field_values[FIELD_ADSR_TIME_SCALE][i] = frame->adsr_time_scale_1;
+		field_values[FIELD_WF_PERIOD][i] = frame->wf_period;
+		field_values[FIELD_WF_AMPLITUDE][i] = frame->wf_amplitude;
+		field_values[FIELD_ADSR_RELEASE_START][i] = frame->adsr_release_start;
 	}
 
-	printf("Distribution chart for %d frames:\n", frame_count);
-	printf("\tadsr_time_scale: ");
-	distribution_calc(&dist_adsr_time_scale);
-	printf("\twf_period: ");
-	distribution_calc(&dist_wf_period);
-	printf("\twf_amplitude: ");
-	distribution_calc(&dist_wf_amplitude);
-	printf("\tadsr_release_start: ");
-	distribution_calc(&dist_adsr_release_start);
+	if (seq_verbose) {
+		printf("Distribution chart for %d frames:\n", frame_count);
+	}
+	distribution_calc(&dist_adsr_time_scale, "adsr_time_scale");
+	distribution_calc(&dist_wf_period, "wf_period");
+	distribution_calc(&dist_wf_amplitude, "wf_amplitude");
+	distribution_calc(&dist_adsr_release_start, "adsr_release_start");
 
-	// Copy output ref maps
-	stream->refs_adsr_time_scale = dist_adsr_time_scale.refs;
-	stream->refs_wf_period = dist_wf_period.refs;
-	stream->refs_wf_amplitude = dist_wf_amplitude.refs;
-	stream->refs_adsr_release_start = dist_adsr_release_start.refs;
+	struct distribution_t* fields[FIELD_COUNT] = { &dist_adsr_time_scale, &dist_wf_period, &dist_wf_amplitude, &dist_adsr_release_start };
+
+	// Packs: the tunes rarely use all the shared refs, so the frame refs can index a local table of the tune instead, 
+	// a byte per entry that indexes the shared table. The fields are then as wide as the largest local table.
+	struct local_refs_t locals[FIELD_COUNT];
+	int use_locals = tune_count > 1 && !(flags & STREAM_HUFFMAN);
+	for (int f = 0; f < FIELD_COUNT; f++) {
+		use_locals = use_locals && fields[f]->refs.bit_count <= 8;
+	}
+	if (use_locals) {
+		int shared_bits[FIELD_COUNT];
+		int shared_size = pack_data_size(fields, field_values, frame_counts, tune_count, flags & ~STREAM_PERIOD_DELTA, NULL);
+		int local_size = 0;
+		for (int f = 0; f < FIELD_COUNT; f++) {
+			local_refs_build(&locals[f], fields[f], field_values[f], frame_counts, tune_count);
+			local_size += locals[f].offsets[tune_count];
+			shared_bits[f] = fields[f]->refs.bit_count;
+			fields[f]->refs.bit_count = locals[f].bit_count;
+		}
+		local_size += pack_data_size(fields, field_values, frame_counts, tune_count, flags & ~STREAM_PERIOD_DELTA, NULL);
+		if (seq_verbose) {
+			printf("Pack refs: %d bytes shared, %d bytes with local tables (%s)\n", shared_size, local_size, local_size < shared_size ? "local" : "shared");
+		}
+		if (local_size >= shared_size) {
+			for (int f = 0; f < FIELD_COUNT; f++) {
+				fields[f]->refs.bit_count = shared_bits[f];
+				free(locals[f].refs);
+				free(locals[f].offsets);
+			}
+			use_locals = 0;
+		}
+	}
+
+	if (flags & STREAM_PERIOD_DELTA) {
+		// The period ref as the interval from the previous ref of the same voice, modulo 256. Every tune starts from ref 0.
+		uint8_t* voices = malloc(frame_count);
+		uint8_t* last_refs = malloc(voice_count);
+		for (int t = 0, first = 0; t < tune_count; first += frame_counts[t++]) {
+			memset(last_refs, 0, voice_count);
+			stream_voices(frame_streams[t], frame_counts[t], voice_count, voices + first);
+			for (int i = first; i < first + frame_counts[t]; i++) {
+				uint8_t ref = field_ref(&dist_wf_period, use_locals ? &locals[FIELD_WF_PERIOD] : NULL, t, field_values[FIELD_WF_PERIOD][i]);
+				period_deltas[i] = (uint8_t)(ref - last_refs[voices[i]]);
+				last_refs[voices[i]] = ref;
+				distribution_add(&dist_wf_period_delta, period_deltas[i]);
+			}
+		}
+		free(voices);
+		free(last_refs);
+		distribution_calc(&dist_wf_period_delta, "wf_period_delta");
+	}
 
 	// Check limitation of uncompress algo
-	if (dist_adsr_time_scale.refs.bit_count > 8 || 
-		dist_wf_period.refs.bit_count > 8 || 
-		dist_wf_amplitude.refs.bit_count > 8 || 
-		dist_adsr_release_start.refs.bit_count > 8) {
-		fprintf(stderr, "Field ref doesn't fit in 8 bit");
+	int err = 0;
+	for (int f = 0; f < FIELD_COUNT; f++) {
+		if (fields[f]->refs.bit_count > 8) {
+			fprintf(stderr, "Field ref doesn't fit in 8 bit");
+			err = 1;
+			break;
+		}
+	}
+	if (err) {
+		for (int f = 0; f < FIELD_COUNT; f++) {
+			free(fields[f]->refs.values);
+			distribution_free(fields[f]);
+		}
+		free(dist_wf_period_delta.refs.values);
+		distribution_free(&dist_wf_period_delta);
+		free(values);
+		free(period_deltas);
+		if (use_locals) {
+			for (int f = 0; f < FIELD_COUNT; f++) {
+				free(locals[f].refs);
+				free(locals[f].offsets);
+			}
+		}
 		return 1;
 	}
 
-	int bits_per_frame = dist_adsr_time_scale.refs.bit_count + dist_wf_period.refs.bit_count + dist_wf_amplitude.refs.bit_count + dist_adsr_release_start.refs.bit_count;
-	// The last frame data will be all 0s
-	stream->data_size = (int)ceil((frame_count + 2) * bits_per_frame / 8.0);
-	printf("Stream size: %d bytes\n", stream->data_size);
+	if (flags & STREAM_HUFFMAN) {
+		distribution_huffman(&dist_adsr_time_scale, "adsr_time_scale");
+		distribution_huffman(&dist_wf_period, "wf_period");
+		distribution_huffman(&dist_wf_amplitude, "wf_amplitude");
+		distribution_huffman(&dist_adsr_release_start, "adsr_release_start");
+		if (flags & STREAM_PERIOD_DELTA) {
+			distribution_huffman(&dist_wf_period_delta, "wf_period_delta");
+		}
+	}
 
-	// +1 again for the write_bits rounding
-	stream->data = malloc(stream->data_size + 1);
-	memset(stream->data, 0, stream->data_size + 1);
+	if (flags & STREAM_PERIOD_DELTA) {
+		// Keep the delta coding only if it pays for its table. The Huffman code tables have a byte per code length.
+		int absolute_size = pack_data_size(fields, field_values, frame_counts, tune_count, flags & ~STREAM_PERIOD_DELTA, NULL) + dist_wf_period.refs.code_bits;
+		fields[FIELD_WF_PERIOD] = &dist_wf_period_delta;
+		field_values[FIELD_WF_PERIOD] = period_deltas;
+		int delta_size = pack_data_size(fields, field_values, frame_counts, tune_count, flags, NULL) + dist_wf_period_delta.refs.count + dist_wf_period_delta.refs.code_bits;
+		if (seq_verbose) {
+			printf("Period refs: %d bytes absolute, %d bytes as deltas (%s)\n", absolute_size, delta_size, delta_size < absolute_size ? "delta" : "absolute");
+		}
+		if (delta_size >= absolute_size) {
+			fields[FIELD_WF_PERIOD] = &dist_wf_period;
+			field_values[FIELD_WF_PERIOD] = values + FIELD_WF_PERIOD * frame_count;
+			flags &= ~STREAM_PERIOD_DELTA;
+			free(dist_wf_period_delta.refs.values);
+			dist_wf_period_delta.refs.values = 0;
+			dist_wf_period_delta.refs.count = 0;
+		}
+	}
+
+	int bits_per_frame = 0;
+	for (int f = 0; f < FIELD_COUNT; f++) {
+		bits_per_frame += fields[f]->refs.bit_count;
+	}
+	stream->tune_count = tune_count;
+	stream->tune_offsets = malloc(sizeof(int) * (tune_count + 1));
+	stream->tune_frame_counts = malloc(sizeof(int) * tune_count);
+	memcpy(stream->tune_frame_counts, frame_counts, sizeof(int) * tune_count);
+	stream->data_size = pack_data_size(fields, field_values, frame_counts, tune_count, flags & ~STREAM_PATTERNS, stream->tune_offsets);
+
+	// STREAM_PATTERNS: the frame that starts each call, and the run called
+	int* call_start = 0;
+	int* call_length = 0;
+	int* bit_pos = 0;
+	if (flags & STREAM_PATTERNS) {
+		uint8_t* refs = malloc(FIELD_COUNT * frame_count);
+		for (int i = 0; i < frame_count; i++) {
+			for (int f = 0; f < FIELD_COUNT; f++) {
+				refs[i * FIELD_COUNT + f] = distribution_ref(fields[f], field_values[f][i]);
+			}
+		}
+		call_start = malloc(sizeof(int) * frame_count);
+		call_length = malloc(sizeof(int) * frame_count);
+		bit_pos = malloc(sizeof(int) * frame_count);
+
+		// The escape ref is one more time scale ref
+		int time_scale_bits = (int)ceil(log(dist_adsr_time_scale.refs.count + 1) / log(2));
+		int frame_bits = bits_per_frame - dist_adsr_time_scale.refs.bit_count + time_scale_bits;
+		// The calls only go back, before the last frame
+		int ptr_bits = 1;
+		while ((1 << ptr_bits) < frame_count * frame_bits) {
+			ptr_bits++;
+		}
+		// Try the length fields up to STREAM_PATTERN_MAX_LEN_BITS
+		int best_bits = 0;
+		int best_len_bits = 0;
+		for (int len_bits = 1; len_bits <= STREAM_PATTERN_MAX_LEN_BITS; len_bits++) {
+			int bits = pattern_parse(refs, frame_count, frame_bits, time_scale_bits + ptr_bits + len_bits, (1 << len_bits) - 1 + STREAM_PATTERN_MIN_LEN, call_start, call_length, bit_pos);
+			if (!best_len_bits || bits < best_bits) {
+				best_bits = bits;
+				best_len_bits = len_bits;
+			}
+		}
+		int pattern_size = (best_bits + 7) / 8;
+		if (seq_verbose) {
+			printf("Patterns: %d bytes with calls, %d bytes without (%s)\n", pattern_size, stream->data_size, pattern_size < stream->data_size ? "calls" : "no calls");
+		}
+		if (pattern_size < stream->data_size && time_scale_bits <= 8 && ptr_bits <= 16) {
+			pattern_parse(refs, frame_count, frame_bits, time_scale_bits + ptr_bits + best_len_bits, (1 << best_len_bits) - 1 + STREAM_PATTERN_MIN_LEN, call_start, call_length, bit_pos);
+			dist_adsr_time_scale.refs.bit_count = time_scale_bits;
+			bits_per_frame = frame_bits;
+			stream->pattern_ptr_bits = ptr_bits;
+			stream->pattern_len_bits = best_len_bits;
+			stream->data_size = pattern_size;
+		} else {
+			flags &= ~STREAM_PATTERNS;
+		}
+		free(refs);
+	}
+
+	stream->flags = flags;
+	stream->frame_bits = bits_per_frame;
+	stream->frame_count = frame_count;
+	// At least a byte, so the stream position moves even with single-valued fields
+	stream->frame_bytes = bits_per_frame ? (bits_per_frame + 7) / 8 : 1;
+	int end_frames = STREAM_COUNTED_END(flags) ? 0 : (flags & STREAM_BYTE_ALIGNED) ? 1 : 2;
+	if (seq_verbose) {
+		if (flags & STREAM_HUFFMAN) {
+			// A table of code counts per field, a byte per code length
+			int table_size = 0;
+			for (int f = 0; f < FIELD_COUNT; f++) {
+				table_size += fields[f]->refs.code_bits;
+			}
+			int fixed_size = pack_data_size(fields, field_values, frame_counts, tune_count, flags & ~STREAM_HUFFMAN, NULL);
+			printf("Stream size: %d bytes (Huffman) + %d bytes of code tables, %d bytes with fixed-width refs (%+.1f%%)\n", 
+				stream->data_size, table_size, fixed_size, fixed_size ? 100.0 * (stream->data_size + table_size - fixed_size) / fixed_size : 0.0);
+		} else {
+			printf("Stream size: %d bytes%s\n", stream->data_size, (flags & STREAM_BYTE_ALIGNED) ? " (byte-aligned frames)" : "");
+		}
+	}
+	stream->tune_offsets[tune_count] = stream->data_size;
+	// No empty arrays in the generated code
+	if (!stream->data_size) {
+		stream->data_size = 1;
+	}
+
+	// The padding covers the write_bits rounding too
+	stream->data = malloc(stream->data_size + STREAM_PADDING);
+	memset(stream->data, 0, stream->data_size + STREAM_PADDING);
 
 	// Now compile down the bit stream
 	struct stream_writer_t stream_writer;
 	stream_writer.buffer = stream->data;
 	stream_writer.pos = 0;
 	stream_writer.bit_pos = 0;
-	for (int i = 0; i < frame_count; i++) {
-		write_bits(&stream_writer, dist_adsr_time_scale.map_of_refs[frame_stream[i].adsr_time_scale_1], dist_adsr_time_scale.refs.bit_count);
-		write_bits(&stream_writer, dist_wf_period.map_of_refs[frame_stream[i].wf_period], dist_wf_period.refs.bit_count);
-		write_bits(&stream_writer, dist_wf_amplitude.map_of_refs[frame_stream[i].wf_amplitude], dist_wf_amplitude.refs.bit_count);
-		write_bits(&stream_writer, dist_adsr_release_start.map_of_refs[frame_stream[i].adsr_release_start], dist_adsr_release_start.refs.bit_count);
+	if (flags & STREAM_HUFFMAN) {
+		for (int t = 0, first = 0; t < tune_count; first += frame_counts[t++]) {
+			stream_writer.pos = stream->tune_offsets[t];
+			stream_writer.bit_pos = 0;
+			for (int i = first; i < first + frame_counts[t]; i++) {
+				for (int f = 0; f < FIELD_COUNT; f++) {
+					write_code(&stream_writer, fields[f], distribution_ref(fields[f], field_values[f][i]));
+				}
+			}
+		}
+
+		// The decoder indexes the ref tables by code
+		for (int f = 0; f < FIELD_COUNT; f++) {
+			distribution_use_code_order(fields[f]);
+		}
+	} else if (flags & STREAM_PATTERNS) {
+		for (int i = 0; i < frame_count; ) {
+			if (call_length[i]) {
+				write_bits(&stream_writer, dist_adsr_time_scale.refs.count, dist_adsr_time_scale.refs.bit_count);
+				write_bits16(&stream_writer, bit_pos[call_start[i]], stream->pattern_ptr_bits);
+				write_bits(&stream_writer, call_length[i] - STREAM_PATTERN_MIN_LEN, stream->pattern_len_bits);
+				i += call_length[i];
+			} else {
+				for (int f = 0; f < FIELD_COUNT; f++) {
+					write_bits(&stream_writer, distribution_ref(fields[f], field_values[f][i]), fields[f]->refs.bit_count);
+				}
+				i++;
+			}
+		}
+	} else {
+		// The period deltas are always in the shared table
+		const struct local_refs_t* frame_locals[FIELD_COUNT];
+		for (int f = 0; f < FIELD_COUNT; f++) {
+			frame_locals[f] = use_locals && fields[f] != &dist_wf_period_delta ? &locals[f] : NULL;
+		}
+		for (int t = 0, first = 0; t < tune_count; first += frame_counts[t++]) {
+			stream_writer.pos = stream->tune_offsets[t];
+			stream_writer.bit_pos = 0;
+			for (int i = first; i < first + frame_counts[t]; i++) {
+				for (int f = 0; f < FIELD_COUNT; f++) {
+					write_bits(&stream_writer, field_ref(fields[f], frame_locals[f], t, field_values[f][i]), fields[f]->refs.bit_count);
+				}
+				if (flags & STREAM_BYTE_ALIGNED) {
+					stream_writer.pos = stream->tune_offsets[t] + (i - first + 1) * stream->frame_bytes;
+					stream_writer.bit_pos = 0;
+				}
+			}
+
+			// EOF. The risk is that a valid note close to the stream end has all refs = 0. However this is only a filler to be discarded when the pointer reaches the end
+			for (int i = 0; i < end_frames; i++) {
+				for (int f = 0; f < FIELD_COUNT; f++) {
+					write_bits(&stream_writer, 0, fields[f]->refs.bit_count);
+				}
+			}
+		}
 	}
 
-	// EOF. The risk is that a valid note close to the stream end has all refs = 0. However this is only a filler to be discarded when the pointer reaches the end
-	for (int i = 0; i < 2; i++) {
-		write_bits(&stream_writer, 0, dist_adsr_time_scale.refs.bit_count);
-		write_bits(&stream_writer, 0, dist_wf_period.refs.bit_count);
-		write_bits(&stream_writer, 0, dist_wf_amplitude.refs.bit_count);
-		write_bits(&stream_writer, 0, dist_adsr_release_start.refs.bit_count);
+	// Copy output ref maps. With STREAM_PERIOD_DELTA the period table stays in value order, the decoder indexes it by the sum of the deltas.
+	stream->refs_adsr_time_scale = dist_adsr_time_scale.refs;
+	stream->refs_wf_period = dist_wf_period.refs;
+	stream->refs_wf_amplitude = dist_wf_amplitude.refs;
+	stream->refs_adsr_release_start = dist_adsr_release_start.refs;
+	stream->refs_wf_period_delta = dist_wf_period_delta.refs;
+	struct distribution_t* shared[FIELD_COUNT] = { &dist_adsr_time_scale, &dist_wf_period, &dist_wf_amplitude, &dist_adsr_release_start };
+	for (int f = 0; f < FIELD_COUNT; f++) {
+		stream->local_refs[f] = 0;
+		stream->local_offsets[f] = 0;
+		if (use_locals) {
+			// Back to the shared refs of each local table
+			int count = shared[f]->refs.count;
+			stream->local_refs[f] = malloc(sizeof(int) * (locals[f].offsets[tune_count] ? locals[f].offsets[tune_count] : 1));
+			for (int t = 0; t < tune_count; t++) {
+				for (int r = 0; r < count; r++) {
+					if (locals[f].refs[t * count + r] >= 0) {
+						stream->local_refs[f][locals[f].offsets[t] + locals[f].refs[t * count + r]] = r;
+					}
+				}
+			}
+			stream->local_offsets[f] = locals[f].offsets;
+			free(locals[f].refs);
+		}
 	}
 
+	distribution_free(&dist_adsr_time_scale);
+	distribution_free(&dist_wf_period);
+	distribution_free(&dist_wf_amplitude);
+	distribution_free(&dist_adsr_release_start);
+	distribution_free(&dist_wf_period_delta);
+	free(values);
+	free(period_deltas);
+	free(call_start);
+	free(call_length);
+	free(bit_pos);
 	return 0;
 }
 
 void stream_free(struct bit_stream_t* stream) {
 	free(stream->data);
+	free(stream->tune_offsets);
+	free(stream->tune_frame_counts);
+	for (int f = 0; f < 4; f++) {
+		free(stream->local_refs[f]);
+		free(stream->local_offsets[f]);
+	}
 	free(stream->refs_adsr_time_scale.values);
 	free(stream->refs_wf_period.values);
 	free(stream->refs_wf_amplitude.values);
 	free(stream->refs_adsr_release_start.values);
+	free(stream->refs_wf_period_delta.values);
 }
 
@@ -0,0 +1,214 @@
+/*!
+ * Block renderer for the stream sequencer, Polyphonic synthesizer for microcontrollers.
+ * (C) 2021 Luciano Martorella
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include "sequencer.h"
+#include "synth.h"
+#include <string.h>
+
+/*!
+ * Not meant for microcontroller usage.
+ * Renders the same output of `seq_feed_synth`, but voice by voice over the whole span
+ * between two frame fetches, so the voice state can stay in registers.
+ * The inner loops are delegated to a kernel, that a port can replace with a SIMD one.
+ */
+
+/*! Number of samples before the voice reaches `ADSR_STATE_END`, including the sample in which it happens */
+static size_t voice_samples_to_end(const struct voice_ch_t* voice) {
+	if (voice->adsr.state_counter == ADSR_STATE_END) {
+		return 1;
+	}
+	// The current state lasts `next_event + 1` samples, then every state lasts `time_scale + 1` samples up to the end
+	return voice->adsr.next_event + 1 + (size_t)(ADSR_TIME_UNITS + 1 - voice->adsr.state_counter) * (voice->adsr.def.time_scale + 1);
+}
+
+static void mix_scalar(int16_t* acc, int16_t value, size_t count) {
+	for (; count; count--, acc++) {
+		*acc += value;
+	}
+}
+
+static size_t output_scalar(int16_t* acc, size_t count) {
+	size_t clipped = 0;
+	for (; count; count--, acc++) {
+		int16_t sample = *acc;
+#ifndef NO_CLIP_CHECK
+		if (sample > INT8_MAX) {
+			sample = INT8_MAX;
+			clipped++;
+		} else if (sample < INT8_MIN) {
+			sample = INT8_MIN;
+			clipped++;
+		}
+#else
+		sample = (int8_t)sample;
+#endif
+		*acc = sample << 8;
+	}
+	return clipped;
+}
+
+static const struct seq_render_kernel_t scalar_kernel = {
+	mix_scalar,
+	output_scalar
+};
+
+static const struct seq_render_kernel_t* kernel = &scalar_kernel;
+
+const struct seq_render_kernel_t* seq_render_scalar_kernel() {
+	return &scalar_kernel;
+}
+
+void seq_render_set_kernel(const struct seq_render_kernel_t* new_kernel) {
+	kernel = new_kernel ? new_kernel : &scalar_kernel;
+}
+
+/*! 
+ * Mix `count` samples of the voice in the accumulator. Same as `voice_ch_next`, with the waveform state kept in locals.
+ * The samples are produced in runs of constant value: the gain only changes at ADSR events (see `adsr_run`), 
+ * and the square wave only when `period_remain` expires.
+ */
+static void voice_render(SYNTH_CTX_PARAM_ struct voice_ch_t* voice, int16_t* acc, size_t count) {
+	int8_t int_sample = voice->wf.int_sample;
+	uint16_t period_remain = voice->wf.period_remain;
+	const uint16_t period = voice->wf.period;
+
+	cur_voice = voice;
+	while (count) {
+		size_t run = adsr_run(SYNTH_CTX_ARG_ count < TIME_SCALE_MAX ? count : TIME_SCALE_MAX);
+		uint8_t gain = voice->adsr.gain;
+		count -= run;
+#ifdef SEQ_STATS
+		if (voice->adsr.state_counter == ADSR_STATE_END) {
+			SEQ_STAT(idle_samples[voice - synth.voice], run);
+		}
+#endif
+
+		if (gain >= 6) {
+			acc += run;
+			continue;
+		}
+
+		// voice_wf_next(), for each run of samples with the same value
+		while (run) {
+			size_t wf_run;
+			if (period > 0) {
+				if ((period_remain >> PERIOD_FP_SCALE) == 0) {
+					int_sample = -int_sample;
+					period_remain += period;
+				}
+				// This sample, plus the ones before the next swap
+				wf_run = 1 + ((uint16_t)(period_remain - (1 << PERIOD_FP_SCALE)) >> PERIOD_FP_SCALE);
+				if (wf_run > run) {
+					wf_run = run;
+				}
+				period_remain -= (uint16_t)(wf_run << PERIOD_FP_SCALE);
+			} else {
+				wf_run = run;
+			}
+
+			int8_t value = int_sample >> gain;
+			if (value) {
+				kernel->mix(acc, value, wf_run);
+			}
+			acc += wf_run;
+			run -= wf_run;
+		}
+	}
+
+	voice->wf.int_sample = int_sample;
+	voice->wf.period_remain = period_remain;
+}
+
+size_t seq_render_block(SYNTH_CTX_PARAM_ int16_t* out, size_t count) {
+	size_t pos = 0;
+	memset(out, 0, count * sizeof(int16_t));
+
+	while (pos < count && !seq_end) {
+		// Find the next sample in which a voice requires a frame:
+		// only the first voice of the sample is fed (see `seq_feed_synth`)
+		size_t span = count - pos;
+		uint8_t feed_idx = seq_voice_count;
+		for (uint8_t i = 0; i < seq_voice_count; i++) {
+			size_t to_end = voice_samples_to_end(&synth.voice[i]);
+			if (to_end < span || (to_end == span && feed_idx == seq_voice_count)) {
+				span = to_end;
+				feed_idx = i;
+			}
+		}
+
+		if (feed_idx == seq_voice_count) {
+			for (uint8_t i = 0; i < seq_voice_count; i++) {
+				voice_render(SYNTH_CTX_ARG_ &synth.voice[i], out + pos, span);
+			}
+			pos += span;
+			continue;
+		}
+
+		// Voices after the fed one don't play the last sample if the stream ends there
+		for (uint8_t i = 0; i < seq_voice_count; i++) {
+			voice_render(SYNTH_CTX_ARG_ &synth.voice[i], out + pos, i <= feed_idx ? span : span - 1);
+		}
+		pos += span;
+
+		cur_voice = &synth.voice[feed_idx];
+		new_frame_require(SYNTH_CTX_ARG);
+		if (seq_buf_frame.adsr_time_scale_1 == 0) {
+			// End-of-stream
+			seq_end = 1;
+			break;
+		}
+		voice_wf_set(SYNTH_CTX_ARG_ &seq_buf_frame);
+		adsr_config(SYNTH_CTX_ARG_ &seq_buf_frame);
+		SEQ_STAT(frames, 1);
+
+		for (uint8_t i = feed_idx + 1; i < seq_voice_count; i++) {
+			voice_render(SYNTH_CTX_ARG_ &synth.voice[i], out + pos - 1, 1);
+#ifdef SEQ_STATS
+			if (synth.voice[i].adsr.state_counter == ADSR_STATE_END) {
+				// Left for the next sample
+				SEQ_STAT(deferred_feeds, 1);
+			}
+#endif
+		}
+	}
+
+	/* Handle clipping, and scale to 16-bit */
+	size_t clipped = kernel->output(out, pos);
+#ifdef CHECK_CLIPPING
+	clip_count += clipped;
+#endif
+	SEQ_STAT(clipped, clipped);
+	SEQ_STAT(samples, pos);
+	return pos;
+}
+
+void seq_render_voices(SYNTH_CTX_PARAM_ int16_t* out, size_t count) {
+	memset(out, 0, count * sizeof(int16_t));
+	for (uint8_t i = 0; i < seq_voice_count; i++) {
+		voice_render(SYNTH_CTX_ARG_ &synth.voice[i], out, count);
+	}
+
+	size_t clipped = kernel->output(out, count);
+#ifdef CHECK_CLIPPING
+	clip_count += clipped;
+#endif
+	SEQ_STAT(clipped, clipped);
+	SEQ_STAT(samples, count);
+}
@@ -20,6 +20,7 @@
 #ifndef _SYNTH_H
 #define _SYNTH_H
 #include "voice.h"
+#include "profile.h"
 
 #ifndef SYNTH_FREQ
 /*!
@@ -39,6 +40,130 @@ struct poly_synth_t {
 	struct voice_ch_t voice[VOICE_COUNT];
 };
 
+#ifdef SEQ_STATS
+/*! Phases of the envelope, by `state_counter`, for the SEQ_STATS counters */
+enum {
+	ADSR_PHASE_ATTACK,
+	ADSR_PHASE_SUSTAIN,
+	ADSR_PHASE_DECAY,
+	ADSR_PHASE_RELEASE,
+	ADSR_PHASE_END,
+	ADSR_PHASE_COUNT
+};
+
+/*!
+ * Counters of the playback, from `seq_play_stream`. Not meant for microcontroller usage.
+ */
+struct seq_stats_t {
+	/*! Samples played */
+	uint32_t samples;
+	/*! Frames fed to the voices */
+	uint32_t frames;
+	/*! Voice samples in each ADSR_PHASE_* */
+	uint32_t adsr_samples[ADSR_PHASE_COUNT];
+	/*! Samples clipped in the mix */
+	uint32_t clipped;
+	/*! Samples of each voice at ADSR_STATE_END, waiting for a frame */
+	uint32_t idle_samples[VOICE_COUNT];
+	/*! Voices at ADSR_STATE_END left for the next sample, since another voice was fed in the sample */
+	uint32_t deferred_feeds;
+};
+
+/*! Add `n` to a counter of `seq_stats` */
+#define SEQ_STAT(counter, n) (seq_stats.counter += (n))
+#else
+#define SEQ_STAT(counter, n)
+#endif
+
+#ifdef SYNTH_REENTRANT
+/*!
+ * Engine instance, with the state of the synth and of the sequencer.
+ * Zero-initialize it before use.
+ */
+struct synth_ctx_t {
+	/*! The voices */
+	struct poly_synth_t synth;
+	/*! Active voice in the voice loops */
+	struct voice_ch_t* cur_voice;
+	/*! Last frame fetched by `new_frame_require` */
+	struct seq_frame_t seq_buf_frame;
+	/*! Set at the stream end */
+	uint8_t seq_end;
+#ifdef SEQ_PREFETCH
+	/*! Set when `seq_buf_frame` holds the next frame, decoded ahead in a sample without feed */
+	uint8_t seq_buf_ready;
+#endif
+	/*! Active voices, set by `seq_play_stream` */
+	uint8_t seq_voice_count;
+#ifdef CHECK_CLIPPING
+	/*! Count of clipped samples */
+	int clip_count;
+#endif
+#ifdef PROFILE_CYCLES
+	/*! PIC cycles of the code paths run so far, see `profile.h` */
+	uint32_t profile_cycles;
+#endif
+#ifdef SEQ_STATS
+	/*! Playback counters */
+	struct seq_stats_t seq_stats;
+#endif
+	/*! Port data, e.g. the frame stream reader used by `new_frame_require` */
+	void* port;
+};
+
+// The engine sources always refer to the state by the global names
+#define synth			(ctx->synth)
+#define cur_voice		(ctx->cur_voice)
+#define seq_buf_frame	(ctx->seq_buf_frame)
+#define seq_end			(ctx->seq_end)
+#ifdef SEQ_PREFETCH
+#define seq_buf_ready	(ctx->seq_buf_ready)
+#endif
+#ifdef CHECK_CLIPPING
+#define clip_count		(ctx->clip_count)
+#endif
+#ifdef PROFILE_CYCLES
+#define profile_cycles	(ctx->profile_cycles)
+#endif
+#ifdef SEQ_STATS
+#define seq_stats		(ctx->seq_stats)
+#endif
+#else
 extern struct poly_synth_t synth;
+extern struct voice_ch_t* cur_voice;
+#ifdef PROFILE_CYCLES
+extern uint32_t profile_cycles;
+#endif
+#ifdef SEQ_STATS
+extern struct seq_stats_t seq_stats;
+#endif
+#endif
+
+/*! Active voices, set by `seq_play_stream` */
+#if defined(SEQ_CHANNEL_COUNT)
+#define seq_voice_count SEQ_CHANNEL_COUNT
+#elif defined(SYNTH_REENTRANT)
+#define seq_voice_count (ctx->seq_voice_count)
+#else
+extern uint8_t seq_voice_count;
+#endif
+
+/*!
+ * Compute the next voice channel sample.
+ */
+inline static int8_t voice_ch_next(SYNTH_CTX_PARAM) {
+	PROFILE_COST(PROFILE_COST_VOICE);
+	adsr_next(SYNTH_CTX_ARG);
+	uint8_t gain = cur_voice->adsr.gain;
+	if (gain >= 6) {
+		return 0;
+	}
+	PROFILE_COST(gain * PROFILE_COST_GAIN_SHIFT);
+
+	int8_t value = voice_wf_next(SYNTH_CTX_ARG);
+	value >>= gain;
+
+	return value;
+}
 
 #endif
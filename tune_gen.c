@@ -19,6 +19,16 @@ const uint8_t tune_adsr_release_start_refs[] = {
 	0x27, 0x37, 
 };
 
+#ifdef ADSR_GAIN
+// Gain after the transition of each ADSR state, by release start ref
+const uint8_t tune_adsr_gains[][66] = {
+	{ 6, 5, 4, 3, 2, 1, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, },
+	{ 6, 5, 4, 3, 2, 1, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, },
+};
+#endif
+
+// In the serial EEPROM with TUNE_EEPROM, see tune_gen.bin
+#ifndef TUNE_EEPROM
 const uint8_t tune_data[TUNE_DATA_SIZE] = {
 	0x84, 0x44, 0xce, 0x10, 0x48, 0x0, 0xd, 0x58, 0x4e, 0xc4, 0x44, 0x4a, 0x11, 0x48, 0x0, 0xc5, 
 	0x44, 0x4e, 0x4, 0x5, 0x81, 0x4, 0x40, 0x50, 0xc5, 0x44, 0x48, 0x4, 0x40, 0x4a, 0xc5, 0x44, 
@@ -88,4 +98,57 @@ const uint8_t tune_data[TUNE_DATA_SIZE] = {
 	0xd0, 0x86, 0x3d, 0xe0, 0x82, 0x6d, 0xd0, 0x86, 0x6d, 0xe0, 0xe, 0xe8, 0x80, 0xe, 0x8, 0x0, 
 	0x0, 0x0, 
 };
+#endif
+
+#if defined(TUNE_GEN_DECODER) && !defined(TUNE_EEPROM)
+// Frame decoder: 12 bits per frame, 2 phases of 3 bytes
+
+static const uint8_t* tune_ptr;
+static uint8_t tune_phase;
+
+void tune_decoder_reset() {
+	tune_ptr = tune_data;
+	tune_phase = 0;
+}
+
+void new_frame_require() {
+	uint8_t ref_adsr_time_scale;
+	uint8_t ref_wf_period;
+	uint8_t ref_wf_amplitude;
+	uint8_t ref_adsr_release_start;
+	uint8_t end;
+	switch (tune_phase) {
+	case 0:
+		ref_adsr_time_scale = tune_ptr[0] & 0x1f;
+		ref_wf_period = (uint8_t)((tune_ptr[0] >> 5) | (tune_ptr[1] << 3)) & 0x1f;
+		ref_wf_amplitude = (uint8_t)(tune_ptr[1] >> 2) & 0x1;
+		ref_adsr_release_start = (uint8_t)(tune_ptr[1] >> 3) & 0x1;
+		end = tune_ptr >= tune_data + 1055;
+		tune_phase = 1;
+		break;
+	default:
+		ref_adsr_time_scale = (uint8_t)((tune_ptr[1] >> 4) | (tune_ptr[2] << 4)) & 0x1f;
+		ref_wf_period = (uint8_t)(tune_ptr[2] >> 1) & 0x1f;
+		ref_wf_amplitude = (uint8_t)(tune_ptr[2] >> 6) & 0x1;
+		ref_adsr_release_start = (uint8_t)(tune_ptr[2] >> 7);
+		end = tune_ptr >= tune_data + 1053;
+		tune_ptr += 3;
+		tune_phase = 0;
+		break;
+	}
+
+	if (end && !ref_adsr_time_scale && !ref_wf_period && !ref_wf_amplitude && !ref_adsr_release_start) {
+		seq_buf_frame.adsr_time_scale_1 = 0;
+	} else {
+		seq_buf_frame.adsr_time_scale_1 = tune_adsr_time_scale_refs[ref_adsr_time_scale];
+		seq_buf_frame.wf_period = tune_wf_period_refs[ref_wf_period];
+		seq_buf_frame.wf_amplitude = tune_wf_amplitude_refs[ref_wf_amplitude];
+#ifdef ADSR_GAIN
+		seq_buf_frame.adsr_release_start = ref_adsr_release_start;
+#else
+		seq_buf_frame.adsr_release_start = tune_adsr_release_start_refs[ref_adsr_release_start];
+#endif
+	}
+}
+#endif
 
@@ -17,4 +17,10 @@ extern const uint16_t tune_wf_period_refs[];
 extern const int8_t tune_wf_amplitude_refs[];
 extern const uint8_t tune_adsr_release_start_refs[];
 extern const uint8_t tune_data[TUNE_DATA_SIZE];
+extern const uint8_t tune_adsr_gains[][66];
+
+#if defined(TUNE_GEN_DECODER) && !defined(TUNE_EEPROM)
+// Rewind the generated decoder
+void tune_decoder_reset(void);
+#endif
 
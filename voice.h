@@ -35,24 +35,12 @@ struct voice_ch_t {
 	 * Waveform generator state.
 	 */
 	struct voice_wf_gen_t wf;
+#ifdef SEQ_PERIOD_DELTA
+	/*!
+	 * Period ref of the last frame, for the STREAM_PERIOD_DELTA streams.
+	 */
+	uint8_t period_ref;
+#endif
 };
 
-extern struct voice_ch_t* cur_voice;
-
-/*!
- * Compute the next voice channel sample.
- */
-inline static int8_t voice_ch_next() {
-	adsr_next();
-	uint8_t gain = cur_voice->adsr.gain;
-	if (gain >= 6) {
-		return 0;
-	}
-
-	int8_t value = voice_wf_next();
-	value >>= gain;
-
-	return value;
-}
-
 #endif
\ No newline at end of file
@@ -22,18 +22,12 @@
 #include "synth.h"
 #include <stdlib.h>
 
-/*!
- * Number of fractional bits for `period` and `period_remain`.
- * This allows tuned notes even in lower sampling frequencies.
- * The integer part (12 bits) is wide enough to render a 20Hz 
- * note on the higher 48kHz sampling frequency.
- */
-#define PERIOD_FP_SCALE 	(4)
-
-int8_t voice_wf_next() {
+int8_t voice_wf_next(SYNTH_CTX_PARAM) {
 	if (cur_voice->wf.period > 0) {
+		PROFILE_COST(PROFILE_COST_WF_STEP);
 		if ((cur_voice->wf.period_remain >> PERIOD_FP_SCALE) == 0) {
 			/* Swap value */
+			PROFILE_COST(PROFILE_COST_WF_SWAP);
 			cur_voice->wf.int_sample = -cur_voice->wf.int_sample;
 			cur_voice->wf.period_remain += cur_voice->wf.period;
 		}
@@ -48,7 +42,7 @@ uint16_t voice_wf_freq_to_period(uint16_t freq) {
 	return (uint16_t)(((uint32_t)synth_freq << PERIOD_FP_SCALE) / freq);
 }
 
-void voice_wf_set(struct seq_frame_t* const frame) {
+void voice_wf_set(SYNTH_CTX_PARAM_ struct seq_frame_t* const frame) {
 	cur_voice->wf.int_sample = cur_voice->wf.int_amplitude = frame->wf_amplitude;
 	cur_voice->wf.period_remain = cur_voice->wf.period = frame->wf_period;
 }
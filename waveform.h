@@ -23,6 +23,14 @@
 
 #include "sequencer.h"
 
+/*!
+ * Number of fractional bits for `period` and `period_remain`.
+ * This allows tuned notes even in lower sampling frequencies.
+ * The integer part (12 bits) is wide enough to render a 20Hz 
+ * note on the higher 48kHz sampling frequency.
+ */
+#define PERIOD_FP_SCALE 	(4)
+
 /*!
  * Waveform generator state.  12 bytes.
  */
@@ -61,12 +69,12 @@ uint16_t voice_wf_freq_to_period(uint16_t frequency);
 /*!
  * Configure the generator using waveform type and common parameters
  */
-void voice_wf_set(struct seq_frame_t* const frame);
+void voice_wf_set(SYNTH_CTX_PARAM_ struct seq_frame_t* const frame);
 
 /*!
  * Retrieve the next sample from the generator.
  */
-int8_t voice_wf_next();
+int8_t voice_wf_next(SYNTH_CTX_PARAM);
 
 /*! Setup def */
 int8_t voice_wf_setup_def(struct seq_frame_t* frame, uint16_t frequency, int8_t amplitude);